@@ -1,6 +1,10 @@
 #include <tcl.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
+
+#include "tdb_library.h"    /* tdbShimScript, generated from library/tdb.tcl */
 
 #ifndef TCL_ALLOW_INLINE_COMPILATION
 #define TCL_ALLOW_INLINE_COMPILATION 0
@@ -18,14 +22,24 @@ typedef enum {
     TDB_BP_NONE = 0,
     TDB_BP_FILE,
     TDB_BP_PROC,
-    TDB_BP_METHOD
+    TDB_BP_METHOD,
+    TDB_BP_LATENCY          /* -proc with -slowerThan: timed by enter/leave traces */
 } TdbBreakpointType;
 
+typedef enum {
+    TDB_LAT_STOP = 0,
+    TDB_LAT_LOG,
+    TDB_LAT_RECORD
+} TdbLatencyAction;
+
+#define TDB_LATENCY_RECORDS 32  /* slow calls kept per -action record breakpoint */
+
 typedef struct TdbBreakpoint {
     int id;
     TdbBreakpointType type;
     Tcl_Obj *filePath;      /* normalized path */
     int line;               /* for file breakpoints */
+    int stopLine;           /* line of the command it stops on, 0 if none */
     Tcl_Obj *procName;      /* ::qualified name */
     Tcl_Obj *methodPattern; /* object glob */
     Tcl_Obj *methodName;    /* method */
@@ -33,35 +47,205 @@ typedef struct TdbBreakpoint {
     Tcl_Obj *hitCountSpec;  /* step 5 */
     int oneshot;            /* step 5 */
     Tcl_Obj *logMessage;    /* step 5 */
+    Tcl_Obj *logSubstCmd;   /* cached {subst -nocommands -nobackslashes logMessage} */
     int hits;               /* step 5: incremented on each candidate hit */
+    Tcl_Obj *coroutinePattern; /* glob on [info coroutine], checked before conditions */
+    /* Overhead budget (-perf.budget) */
+    Tcl_WideInt costNs;     /* evaluation time charged in the current window */
+    int sampleEvery;        /* >1: evaluate only every Nth candidate hit */
+    unsigned int sampleTick;
+    int disabled;           /* over budget while sampled: never evaluated */
+    /* Latency breakpoints (-slowerThan) */
+    Tcl_Obj *slowerThan;    /* threshold as given */
+    Tcl_WideInt thresholdNs;
+    TdbLatencyAction action;
+    int traced;             /* enter/leave trace is installed on procName */
+    Tcl_HashTable *starts;  /* "coroutine\nlevel" -> entry time of the active call */
+    Tcl_WideInt calls, slowCalls, maxNs;
+    Tcl_Obj *records;       /* -action record: last slow calls, oldest first */
 } TdbBreakpoint;
 
+typedef enum {
+    TDB_EV_STOPPED = 0,
+    TDB_EV_LOG,
+    TDB_EV_DEGRADED,
+    TDB_EV_KINDS
+} TdbEventKind;
+
+typedef struct TdbQueuedEvent {
+    struct TdbQueuedEvent *next;
+    TdbEventKind kind;
+    Tcl_Obj *dict;          /* refcounted event dict */
+    Tcl_Obj *locals;        /* full snapshot behind a stop's localsDelta, or NULL */
+} TdbQueuedEvent;
+
+/* Per-file executed-line marks for tdb::coverage; hit[line] for 1-based lines */
+typedef struct TdbCoverageFile {
+    Tcl_Obj *path;          /* normalized path */
+    int excluded;           /* outside -files: indexed but not marked */
+    int numLines;           /* slots in hit and isCode */
+    unsigned char *hit;     /* line executed at least once */
+    unsigned char *isCode;  /* lines where a command starts, from the source scan */
+} TdbCoverageFile;
+
+typedef struct {
+    TdbCoverageFile *file;
+    int line;
+} TdbCoverageLoc;
+
+/* Where a command's source text lives, keyed by TdbCoverageKey of that text */
+#define TDB_COVERAGE_MAX_SITES 65536  /* cap on entries learned from dynamic code */
+#define TDB_COVERAGE_KEY_HEAD 96      /* longer commands are keyed by head, length and tail */
+#define TDB_COVERAGE_KEY_TAIL 32
+#define TDB_COVERAGE_DYN_LIMIT 16     /* unindexed runs per word before they are ignored */
+typedef struct TdbCoverageSite {
+    int numLocs;            /* places in scanned files; others are found by [info frame] */
+    int done;               /* every place is marked: nothing left to do */
+    TdbCoverageLoc *locs;
+} TdbCoverageSite;
+
+/* Interned literals: command words and dict keys used on every hit */
+typedef enum {
+    TDB_LIT_INFO, TDB_LIT_QINFO, TDB_LIT_FRAME, TDB_LIT_MINUS1, TDB_LIT_ZERO,
+    TDB_LIT_LEVEL, TDB_LIT_LOCALS, TDB_LIT_ARGS, TDB_LIT_COROUTINE,
+    TDB_LIT_UPLEVEL, TDB_LIT_SET, TDB_LIT_CMD, TDB_LIT_SUBST,
+    TDB_LIT_NOCOMMANDS, TDB_LIT_NOBACKSLASHES, TDB_LIT_PUTS,
+    TDB_LIT_EVENT, TDB_LIT_REASON, TDB_LIT_STOPPED, TDB_LIT_BREAKPOINT,
+    TDB_LIT_LOG, TDB_LIT_LOGPOINT, TDB_LIT_ID, TDB_LIT_MESSAGE,
+    TDB_LIT_FILE, TDB_LIT_LINE, TDB_LIT_TYPE, TDB_LIT_PROC, TDB_LIT_EVAL,
+    TDB_LIT_METHOD, TDB_LIT_PATTERN, TDB_LIT_CONDITION, TDB_LIT_HITCOUNT,
+    TDB_LIT_ONESHOT, TDB_LIT_LOCALSDELTA, TDB_LIT_FULL, TDB_LIT_ADDED,
+    TDB_LIT_CHANGED, TDB_LIT_REMOVED, TDB_LIT_DEGRADED, TDB_LIT_BUDGET,
+    TDB_LIT_ACTION, TDB_LIT_SAMPLE, TDB_LIT_DISABLE, TDB_LIT_SAMPLEEVERY,
+    TDB_LIT_OVERHEAD, TDB_LIT_SLOW, TDB_LIT_SLOWERTHAN,
+    TDB_LIT_ELAPSED, TDB_LIT_STOP, TDB_LIT_RECORD, TDB_LIT_CALLS,
+    TDB_LIT_SLOWCALLS, TDB_LIT_MAXELAPSED, TDB_LIT_RECORDS, TDB_LIT_TOTAL,
+    TDB_LIT_FRAMES, TDB_LIT_SEQ, TDB_LIT_BASE,
+    TDB_LIT_JSON_EVENT, TDB_LIT_JSON_FRAMES, TDB_LIT_JSON_PAGE,
+    TDB_LIT_COUNT
+} TdbLiteral;
+
+/* One [info frame] dict, for the tdb::frames JSON schemas */
+#define TDB_JSON_FRAME_SCHEMA \
+    "object {type string file string cmd string proc string method string class string lambda string}"
+
+static const char *const tdbLiteralText[TDB_LIT_COUNT] = {
+    "info", "::info", "frame", "-1", "0",
+    "level", "locals", "args", "coroutine",
+    "uplevel", "set", "cmd", "subst",
+    "-nocommands", "-nobackslashes", "puts",
+    "event", "reason", "stopped", "breakpoint",
+    "log", "logpoint", "id", "message",
+    "file", "line", "type", "proc", "eval",
+    "method", "pattern", "condition", "hitCount",
+    "oneshot", "localsDelta", "full", "added",
+    "changed", "removed", "degraded", "budget",
+    "action", "sample", "disable", "sampleEvery",
+    "overhead", "slow", "slowerThan",
+    "elapsed", "stop", "record", "calls",
+    "slowCalls", "maxElapsed", "records", "total",
+    "frames", "seq", "base",
+    /* JSON schemas (see TdbJsonEncode) */
+    "object {event string reason string type string file string cmd string proc string"
+        " coroutine string method string class string lambda string message string"
+        " locals dict localsDelta {object {frame string added dict changed dict removed {array string}}}}",
+    "array {" TDB_JSON_FRAME_SCHEMA "}",
+    "object {frames {array {" TDB_JSON_FRAME_SCHEMA "}}}"
+};
+
+#define TDB_LEVEL_CACHE 64  /* "#N" objects kept for uplevel */
+#define TDB_LINE_DRIFT 2    /* file breakpoints without a command on their line move this far */
+
+/* Last locals snapshot published for one frame invocation */
+#define TDB_LOCALS_FRAMES_MAX 256  /* frames remembered before starting over */
+typedef struct {
+    Tcl_Obj *frameId;
+    Tcl_Obj *procName;
+    Tcl_Obj *snapshot;
+    int seq;                /* stops published in this frame so far */
+} TdbFrameLocals;
+
 typedef struct {
     Tcl_Interp *interp;
     int started;
+    int shimLoaded;          /* embedded library script has been evaluated */
     int perfAllowInline;
     int pathNormalize;
     int safeEval;
+    int safeEvalPoolSize;    /* idle safe children kept for tdb::eval */
+    int safeEvalIdleMs;      /* evict pooled children idle this long (0 = never) */
+    double perfBudget;       /* max % of wall time one breakpoint may use (0 = off) */
+    int perfBudgetWindowMs;  /* accounting window for perfBudget */
+    Tcl_WideInt budgetWindowStart;
+    double budgetLastPct;    /* all breakpoints, last completed window */
+    int degradedCount;
 
     Tcl_HashTable breakpoints; /* key: (void*)(intptr_t)id -> TdbBreakpoint* */
     int nextBreakpointId;
+    Tcl_WideInt bpGeneration; /* advanced by every add/rm/clear */
+    Tcl_Obj *bpListCache;    /* [tdb::break ls] result; NULL when stale */
+    TdbBreakpoint **bpOrder; /* breakpoints behind bpListCache, in id order */
+    int bpOrderCap;
     int fileBreakpointCount;
     int procBreakpointCount;
     int methodBreakpointCount;
+    int latencyBreakpointCount;
+    int *latencyPending;     /* ids of latency breakpoints whose proc is not traced */
+    int numLatencyPending, latencyPendingCap;
+    int procHooked;          /* leave trace on ::proc retries latencyPending */
+    int batchDepth;          /* >0 inside tdb::break batch */
+    int recomputePending;    /* tracing recompute deferred by a batch */
+    int inFileLineHook;      /* ::tdb::_apply_fileline_breaks is running */
+    int recomputeIdle;       /* a recompute is queued for the idle loop */
+    Tcl_Obj *batchAdded;     /* ids added during the outermost batch */
 
     int isPaused;            /* re-entrancy guard for future trace */
     Tcl_Obj *lastStopDict;   /* refcounted */
+    int stopFrame;           /* [info frame] index of the paused command, 0 if unknown */
+    /* Event FIFO drained by tdb::wait and tdb::on callbacks */
+    TdbQueuedEvent *eventHead;
+    TdbQueuedEvent *eventTail;
+    int eventCount;
+    int eventQueueMax;
+    int eventsDropped;
+    int eventsOverrun;       /* stops queued beyond eventQueueMax */
+    int stoppedIdle;         /* ::tdb::_stopped resync is queued for idle */
+    int waiters;             /* nested tdb::wait calls blocked in the notifier */
+    int wakePending;         /* a TdbWakeEvent is already queued */
+    int syncingStopped;      /* engine itself is rewriting ::tdb::_stopped */
+    Tcl_Obj *onEvent[TDB_EV_KINDS]; /* tdb::on callback prefixes */
     /* Trace (Prompt 4B) */
     Tcl_Trace objTrace;      /* installed object trace token */
+    int objTraceFlags;       /* flags objTrace was created with */
+    int objTraceKind;        /* TdbTraceKind of the installed callback */
+    Tcl_HashTable fileBpWords; /* first words of the commands on file breakpoint lines */
+    int fileBpAnyWord;       /* a breakpoint line starts with a substituted word */
+    Tcl_HashTable fileLineWords; /* normalized path -> TdbLineWords* of breakpoint files */
+    Tcl_Obj *traceName;      /* scratch buffer for command full names */
     int traceHits;           /* number of callbacks */
     int haveProcBps;         /* fast flag */
     int haveFileLineBps;     /* fast flag */
     /* Fast-path metrics (Prompt 4E) */
     int frameLookups;
-    int procFastRejects;
+    int procFastRejects;     /* proc entries with no proc breakpoint (tdb::_proc_bps) */
     int fileFastRejects;
+    /* Line coverage (tdb::coverage) */
+    int coverageActive;
+    Tcl_Obj *coveragePattern;     /* -files glob on normalized paths; NULL = all */
+    Tcl_HashTable coverageFiles;  /* normalized path -> TdbCoverageFile* */
+    Tcl_HashTable coverageSites;  /* TdbCoverageKey -> TdbCoverageSite* */
+    Tcl_HashTable coverageDynWords; /* first word -> unindexed runs that marked nothing new */
+    /* Locals deltas between stops */
+    Tcl_HashTable localsFrames;   /* frame id -> TdbFrameLocals* */
+    Tcl_Obj *lastLocals;          /* full snapshot of the current stop */
+    Tcl_Obj *lastDelta;           /* its localsDelta */
+    /* Literal pool: shared, never modified; owned by the state */
+    Tcl_Obj *lit[TDB_LIT_COUNT];
+    Tcl_Obj *levelObjs[TDB_LEVEL_CACHE];
 } TdbState;
 
+#define TDB_LIT(state, id) ((state)->lit[TDB_LIT_##id])
+
 /* ----------------------------------------------------------------------
  * Utilities
  * ---------------------------------------------------------------------- */
@@ -79,8 +263,20 @@ TdbError(Tcl_Interp *interp, const char *subsystem, const char *detail, const ch
 }
 
 static void TdbStateCleanup(ClientData clientData, Tcl_Interp *interp);
+static void TdbEventQueueClear(TdbState *state, int kind);
+static int TdbWakeEventDeleteProc(Tcl_Event *evPtr, ClientData clientData);
 static int TdbEnterPauseCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]);
+static int TdbShimLoad(Tcl_Interp *interp);
 static int TdbHitSpecOk(const char *spec, int hits);
+static void TdbCoverageReset(TdbState *state);
+static void TdbLocalsReset(TdbState *state);
+static void TdbLocalsDeliver(TdbState *state, TdbQueuedEvent *qe);
+static void TdbLatencyTrace(TdbState *state, TdbBreakpoint *bp, int install);
+static void Tdb_RecomputeTracing(Tcl_Interp *interp);
+static void TdbRecomputeIdleProc(ClientData cd);
+static void TdbStoppedIdleProc(ClientData cd);
+static Tcl_Obj *TdbReadSourceText(Tcl_Obj *pathObj);
+static void TdbFileLineWordsClear(TdbState *state);
 
 static TdbState *
 TdbGetState(Tcl_Interp *interp)
@@ -93,8 +289,24 @@ TdbGetState(Tcl_Interp *interp)
     state->perfAllowInline = 1;
     state->pathNormalize = 1;
     state->safeEval = 0;
+    state->safeEvalPoolSize = 2;
+    state->safeEvalIdleMs = 30000;
+    state->perfBudgetWindowMs = 1000;
+    state->eventQueueMax = 256;
     state->nextBreakpointId = 1;
     Tcl_InitHashTable(&state->breakpoints, TCL_ONE_WORD_KEYS);
+    Tcl_InitHashTable(&state->coverageFiles, TCL_STRING_KEYS);
+    Tcl_InitHashTable(&state->coverageSites, TCL_STRING_KEYS);
+    Tcl_InitHashTable(&state->coverageDynWords, TCL_STRING_KEYS);
+    Tcl_InitHashTable(&state->localsFrames, TCL_STRING_KEYS);
+    Tcl_InitHashTable(&state->fileBpWords, TCL_STRING_KEYS);
+    Tcl_InitHashTable(&state->fileLineWords, TCL_STRING_KEYS);
+    state->traceName = Tcl_NewObj();
+    Tcl_IncrRefCount(state->traceName);
+    for (int i = 0; i < TDB_LIT_COUNT; i++) {
+        state->lit[i] = Tcl_NewStringObj(tdbLiteralText[i], -1);
+        Tcl_IncrRefCount(state->lit[i]);
+    }
     Tcl_SetAssocData(interp, "tdb::state", TdbStateCleanup, state);
     return state;
 }
@@ -125,6 +337,7 @@ TdbAdjustCounts(TdbState *state, TdbBreakpointType type, int delta)
     if (type == TDB_BP_FILE) state->fileBreakpointCount += delta;
     else if (type == TDB_BP_PROC) state->procBreakpointCount += delta;
     else if (type == TDB_BP_METHOD) state->methodBreakpointCount += delta;
+    else if (type == TDB_BP_LATENCY) state->latencyBreakpointCount += delta;
     if (state->fileBreakpointCount < 0) state->fileBreakpointCount = 0;
     if (state->procBreakpointCount < 0) state->procBreakpointCount = 0;
     if (state->methodBreakpointCount < 0) state->methodBreakpointCount = 0;
@@ -132,6 +345,33 @@ TdbAdjustCounts(TdbState *state, TdbBreakpointType type, int delta)
     state->haveFileLineBps = state->fileBreakpointCount > 0;
 }
 
+/* Drop the cached breakpoint list and advance the generation on adds and
+ * removals. Counters shown by ls (latency, degradation) are not cached;
+ * see TdbBreakpointLive. */
+static void
+TdbBreakListInvalidate(TdbState *state)
+{
+    state->bpGeneration++;
+    if (state->bpListCache) {
+        Tcl_DecrRefCount(state->bpListCache);
+        state->bpListCache = NULL;
+    }
+}
+
+/* Forget the entry times of active calls: their leaves are not timed */
+static void
+TdbLatencyClearStarts(TdbBreakpoint *bp)
+{
+    if (!bp->starts) return;
+    Tcl_HashSearch search;
+    for (Tcl_HashEntry *entry = Tcl_FirstHashEntry(bp->starts, &search); entry; entry = Tcl_NextHashEntry(&search)) {
+        ckfree((char *)Tcl_GetHashValue(entry));
+    }
+    Tcl_DeleteHashTable(bp->starts);
+    ckfree((char *)bp->starts);
+    bp->starts = NULL;
+}
+
 static void
 TdbBreakpointFree(TdbBreakpoint *bp)
 {
@@ -143,6 +383,11 @@ TdbBreakpointFree(TdbBreakpoint *bp)
     if (bp->condition) Tcl_DecrRefCount(bp->condition);
     if (bp->hitCountSpec) Tcl_DecrRefCount(bp->hitCountSpec);
     if (bp->logMessage) Tcl_DecrRefCount(bp->logMessage);
+    if (bp->logSubstCmd) Tcl_DecrRefCount(bp->logSubstCmd);
+    if (bp->coroutinePattern) Tcl_DecrRefCount(bp->coroutinePattern);
+    if (bp->slowerThan) Tcl_DecrRefCount(bp->slowerThan);
+    if (bp->records) Tcl_DecrRefCount(bp->records);
+    TdbLatencyClearStarts(bp);
     ckfree(bp);
 }
 
@@ -152,8 +397,10 @@ TdbRemoveBreakpointEntry(TdbState *state, Tcl_HashEntry *entry)
     if (!entry) return;
     TdbBreakpoint *bp = (TdbBreakpoint *)Tcl_GetHashValue(entry);
     if (bp) TdbAdjustCounts(state, bp->type, -1);
+    if (bp && bp->type == TDB_BP_LATENCY) TdbLatencyTrace(state, bp, 0);
     TdbBreakpointFree(bp);
     Tcl_DeleteHashEntry(entry);
+    TdbBreakListInvalidate(state);
 }
 
 static void
@@ -166,10 +413,13 @@ TdbBreakpointClearAll(TdbState *state)
         TdbRemoveBreakpointEntry(state, entry);
         entry = next;
     }
+    TdbBreakListInvalidate(state);
     state->nextBreakpointId = 1;
     state->fileBreakpointCount = 0;
     state->procBreakpointCount = 0;
     state->methodBreakpointCount = 0;
+    state->latencyBreakpointCount = 0;
+    state->numLatencyPending = 0;
 }
 
 static void
@@ -178,9 +428,34 @@ TdbStateCleanup(ClientData clientData, Tcl_Interp *interp)
     (void)interp;
     TdbState *state = (TdbState *)clientData;
     if (!state) return;
+    if (state->recomputeIdle) Tcl_CancelIdleCall(TdbRecomputeIdleProc, state);
+    if (state->stoppedIdle) Tcl_CancelIdleCall(TdbStoppedIdleProc, state);
     TdbBreakpointClearAll(state);
+    if (state->bpOrder) ckfree((char *)state->bpOrder);
+    if (state->latencyPending) ckfree((char *)state->latencyPending);
     Tcl_DeleteHashTable(&state->breakpoints);
     if (state->lastStopDict) Tcl_DecrRefCount(state->lastStopDict);
+    if (state->batchAdded) Tcl_DecrRefCount(state->batchAdded);
+    TdbEventQueueClear(state, -1);
+    Tcl_DeleteEvents(TdbWakeEventDeleteProc, state);
+    for (int k = 0; k < TDB_EV_KINDS; k++) {
+        if (state->onEvent[k]) Tcl_DecrRefCount(state->onEvent[k]);
+    }
+    TdbCoverageReset(state);
+    Tcl_DeleteHashTable(&state->coverageFiles);
+    Tcl_DeleteHashTable(&state->coverageSites);
+    Tcl_DeleteHashTable(&state->coverageDynWords);
+    if (state->coveragePattern) Tcl_DecrRefCount(state->coveragePattern);
+    TdbLocalsReset(state);
+    Tcl_DeleteHashTable(&state->localsFrames);
+    Tcl_DeleteHashTable(&state->fileBpWords);
+    TdbFileLineWordsClear(state);
+    Tcl_DeleteHashTable(&state->fileLineWords);
+    Tcl_DecrRefCount(state->traceName);
+    for (int i = 0; i < TDB_LIT_COUNT; i++) Tcl_DecrRefCount(state->lit[i]);
+    for (int i = 0; i < TDB_LEVEL_CACHE; i++) {
+        if (state->levelObjs[i]) Tcl_DecrRefCount(state->levelObjs[i]);
+    }
     ckfree(state);
 }
 
@@ -199,670 +474,3581 @@ TdbMaybeNormalizePath(TdbState *state, Tcl_Obj *pathObj)
 static Tcl_Obj *
 TdbBreakpointToDict(Tcl_Interp *interp, const TdbBreakpoint *bp)
 {
+    TdbState *state = TdbGetState(interp);
     Tcl_Obj *dict = Tcl_NewDictObj();
-    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("id", -1), Tcl_NewIntObj(bp->id));
-    const char *typeStr = "unknown";
+    Tcl_DictObjPut(interp, dict, TDB_LIT(state, ID), Tcl_NewIntObj(bp->id));
+    Tcl_Obj *typeObj;
     switch (bp->type) {
-        case TDB_BP_FILE: typeStr = "file"; break;
-        case TDB_BP_PROC: typeStr = "proc"; break;
-        case TDB_BP_METHOD: typeStr = "method"; break;
-        default: break;
+        case TDB_BP_FILE: typeObj = TDB_LIT(state, FILE); break;
+        case TDB_BP_PROC:
+        case TDB_BP_LATENCY: typeObj = TDB_LIT(state, PROC); break;
+        case TDB_BP_METHOD: typeObj = TDB_LIT(state, METHOD); break;
+        default: typeObj = Tcl_NewStringObj("unknown", -1); break;
     }
-    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("type", -1), Tcl_NewStringObj(typeStr, -1));
+    Tcl_DictObjPut(interp, dict, TDB_LIT(state, TYPE), typeObj);
     if (bp->filePath) {
-        Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("file", -1), bp->filePath);
+        Tcl_DictObjPut(interp, dict, TDB_LIT(state, FILE), bp->filePath);
         Tcl_IncrRefCount(bp->filePath); Tcl_DecrRefCount(bp->filePath);
     }
-    if (bp->line > 0) Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("line", -1), Tcl_NewIntObj(bp->line));
-    if (bp->procName) { Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("proc", -1), bp->procName); Tcl_IncrRefCount(bp->procName); Tcl_DecrRefCount(bp->procName); }
-    if (bp->methodPattern) { Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("pattern", -1), bp->methodPattern); Tcl_IncrRefCount(bp->methodPattern); Tcl_DecrRefCount(bp->methodPattern); }
-    if (bp->methodName) { Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("method", -1), bp->methodName); Tcl_IncrRefCount(bp->methodName); Tcl_DecrRefCount(bp->methodName); }
-    if (bp->condition) { Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("condition", -1), bp->condition); Tcl_IncrRefCount(bp->condition); Tcl_DecrRefCount(bp->condition); }
-    if (bp->hitCountSpec) { Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("hitCount", -1), bp->hitCountSpec); Tcl_IncrRefCount(bp->hitCountSpec); Tcl_DecrRefCount(bp->hitCountSpec); }
-    if (bp->logMessage) { Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("log", -1), bp->logMessage); Tcl_IncrRefCount(bp->logMessage); Tcl_DecrRefCount(bp->logMessage); }
-    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("oneshot", -1), Tcl_NewBooleanObj(bp->oneshot));
+    if (bp->line > 0) Tcl_DictObjPut(interp, dict, TDB_LIT(state, LINE), Tcl_NewIntObj(bp->line));
+    if (bp->procName) { Tcl_DictObjPut(interp, dict, TDB_LIT(state, PROC), bp->procName); Tcl_IncrRefCount(bp->procName); Tcl_DecrRefCount(bp->procName); }
+    if (bp->methodPattern) { Tcl_DictObjPut(interp, dict, TDB_LIT(state, PATTERN), bp->methodPattern); Tcl_IncrRefCount(bp->methodPattern); Tcl_DecrRefCount(bp->methodPattern); }
+    if (bp->methodName) { Tcl_DictObjPut(interp, dict, TDB_LIT(state, METHOD), bp->methodName); Tcl_IncrRefCount(bp->methodName); Tcl_DecrRefCount(bp->methodName); }
+    if (bp->condition) { Tcl_DictObjPut(interp, dict, TDB_LIT(state, CONDITION), bp->condition); Tcl_IncrRefCount(bp->condition); Tcl_DecrRefCount(bp->condition); }
+    if (bp->hitCountSpec) { Tcl_DictObjPut(interp, dict, TDB_LIT(state, HITCOUNT), bp->hitCountSpec); Tcl_IncrRefCount(bp->hitCountSpec); Tcl_DecrRefCount(bp->hitCountSpec); }
+    if (bp->logMessage) { Tcl_DictObjPut(interp, dict, TDB_LIT(state, LOG), bp->logMessage); Tcl_IncrRefCount(bp->logMessage); Tcl_DecrRefCount(bp->logMessage); }
+    if (bp->coroutinePattern) Tcl_DictObjPut(interp, dict, TDB_LIT(state, COROUTINE), bp->coroutinePattern);
+    Tcl_DictObjPut(interp, dict, TDB_LIT(state, ONESHOT), Tcl_NewBooleanObj(bp->oneshot));
+    if (bp->type == TDB_BP_LATENCY) {
+        static const TdbLiteral actions[] = { TDB_LIT_STOP, TDB_LIT_LOG, TDB_LIT_RECORD };
+        Tcl_DictObjPut(interp, dict, TDB_LIT(state, SLOWERTHAN), bp->slowerThan);
+        Tcl_DictObjPut(interp, dict, TDB_LIT(state, ACTION), state->lit[actions[bp->action]]);
+    }
     return dict;
 }
 
-/* ----------------------------------------------------------------------
- * Pause/resume plumbing
- * ---------------------------------------------------------------------- */
-
-static void
-Tdb_SetStopEvent(Tcl_Interp *interp, Tcl_Obj *eventDict)
+/* Latency timing and -perf.budget degradation: counters that change on
+ * every timed call, so they stay out of the cached list */
+static int
+TdbBreakpointHasLive(const TdbBreakpoint *bp)
 {
-    TdbState *state = TdbGetState(interp);
-    Tcl_IncrRefCount(eventDict);
-    if (state->lastStopDict) Tcl_DecrRefCount(state->lastStopDict);
-    state->lastStopDict = eventDict;
-
-    /* publish to globals */
-    Tcl_IncrRefCount(eventDict);
-    Tcl_SetVar2Ex(interp, TDB_GLOBAL_VAR_STOPPED, NULL, eventDict, TCL_GLOBAL_ONLY);
-    Tcl_DecrRefCount(eventDict);
-
-    Tcl_IncrRefCount(eventDict);
-    Tcl_SetVar2Ex(interp, TDB_GLOBAL_VAR_LAST_STOP, NULL, eventDict, TCL_GLOBAL_ONLY);
-    Tcl_DecrRefCount(eventDict);
-
-    /* Also set via script to ensure write-traces fire consistently across versions */
-    Tcl_Obj *script = Tcl_NewObj();
-    Tcl_IncrRefCount(script);
-    Tcl_AppendToObj(script, "set ::tdb::_stopped ", -1);
-    Tcl_AppendObjToObj(script, eventDict);
-    Tcl_AppendToObj(script, "; set ::tdb::_last_stop ", -1);
-    Tcl_AppendObjToObj(script, eventDict);
-    Tcl_EvalObjEx(interp, script, TCL_EVAL_GLOBAL|TCL_EVAL_DIRECT);
-    Tcl_DecrRefCount(script);
+    return bp->type == TDB_BP_LATENCY || bp->disabled || bp->sampleEvery > 1;
 }
 
-static void
-Tdb_EnterPauseLoop(Tcl_Interp *interp)
+/* The dict of bp as ls shows it: the cached one, or a copy with the live
+ * counters merged in */
+static Tcl_Obj *
+TdbBreakpointLive(TdbState *state, const TdbBreakpoint *bp, Tcl_Obj *dict)
 {
-    TdbState *state = TdbGetState(interp);
-    if (state->isPaused) return; /* re-entrancy guard */
-    state->isPaused = 1;
-    if (Tcl_EvalEx(interp, "vwait ::tdb::_resume", -1, TCL_EVAL_GLOBAL) != TCL_OK) {
-        Tcl_BackgroundError(interp);
+    if (!TdbBreakpointHasLive(bp)) return dict;
+    dict = Tcl_DuplicateObj(dict);
+    if (bp->type == TDB_BP_LATENCY) {
+        Tcl_DictObjPut(NULL, dict, TDB_LIT(state, CALLS), Tcl_NewWideIntObj(bp->calls));
+        Tcl_DictObjPut(NULL, dict, TDB_LIT(state, SLOWCALLS), Tcl_NewWideIntObj(bp->slowCalls));
+        Tcl_DictObjPut(NULL, dict, TDB_LIT(state, MAXELAPSED), Tcl_NewDoubleObj((double)bp->maxNs / 1e6));
+        if (bp->records) Tcl_DictObjPut(NULL, dict, TDB_LIT(state, RECORDS), bp->records);
     }
-    Tcl_UnsetVar(interp, TDB_GLOBAL_VAR_RESUME, TCL_GLOBAL_ONLY);
-    state->isPaused = 0;
+    if (bp->disabled) {
+        Tcl_DictObjPut(NULL, dict, TDB_LIT(state, DEGRADED), TDB_LIT(state, DISABLE));
+    } else if (bp->sampleEvery > 1) {
+        Tcl_DictObjPut(NULL, dict, TDB_LIT(state, DEGRADED), TDB_LIT(state, SAMPLE));
+        Tcl_DictObjPut(NULL, dict, TDB_LIT(state, SAMPLEEVERY), Tcl_NewIntObj(bp->sampleEvery));
+    }
+    return dict;
 }
 
-/* ----------------------------------------------------------------------
- * Object trace installation (Prompt 4B)
- * ---------------------------------------------------------------------- */
+/* "#N" for uplevel; shallow levels come from the pool. The caller takes
+ * its own reference while using the object. */
+static Tcl_Obj *
+TdbLevelObj(TdbState *state, int level)
+{
+    char buf[32];
+    if (level >= 0 && level < TDB_LEVEL_CACHE && state->levelObjs[level]) return state->levelObjs[level];
+    snprintf(buf, sizeof(buf), "#%d", level);
+    if (level < 0 || level >= TDB_LEVEL_CACHE) return Tcl_NewStringObj(buf, -1);
+    state->levelObjs[level] = Tcl_NewStringObj(buf, -1);
+    Tcl_IncrRefCount(state->levelObjs[level]);
+    return state->levelObjs[level];
+}
 
+/* [info frame -1|0] from pooled words; new reference, or NULL on failure */
+static Tcl_Obj *
+TdbInfoFrame(TdbState *state, Tcl_Interp *ip, Tcl_Obj *which)
+{
+    Tcl_Obj *argv0[3];
+    argv0[0] = TDB_LIT(state, INFO);
+    argv0[1] = TDB_LIT(state, FRAME);
+    argv0[2] = which;
+    if (Tcl_EvalObjv(ip, 3, argv0, TCL_EVAL_GLOBAL|TCL_EVAL_DIRECT) != TCL_OK) return NULL;
+    Tcl_Obj *frame = Tcl_GetObjResult(ip);
+    Tcl_IncrRefCount(frame);
+    return frame;
+}
+
+/* [info level] or [info frame] of the caller; -1 on failure */
 static int
-Tdb_ObjTraceProc(ClientData cd, Tcl_Interp *ip, int level, const char *cmdStr,
-                 Tcl_Command cmdTok, int objc, Tcl_Obj *const objv[])
+TdbInfoInt(TdbState *state, Tcl_Interp *ip, Tcl_Obj *which)
 {
-    (void)level; (void)cmdStr; (void)cmdTok; (void)objc; (void)objv;
-    TdbState *state = (TdbState *)cd;
-    state->traceHits++;
-    if (state->isPaused) {
-        return TCL_OK;
+    Tcl_Obj *argv0[2];
+    int value = -1;
+    argv0[0] = TDB_LIT(state, INFO);
+    argv0[1] = which;
+    if (Tcl_EvalObjv(ip, 2, argv0, TCL_EVAL_DIRECT) != TCL_OK ||
+        Tcl_GetIntFromObj(NULL, Tcl_GetObjResult(ip), &value) != TCL_OK) {
+        value = -1;
     }
-    /* fast path work only; avoid side-effects while tracing */
-    int doPause = 0;
-    const char *procName = NULL;
-    Tcl_Obj *procNameObj = NULL; /* hold reference-safe proc name */
-    Tcl_Obj *frameDict = NULL;
-    Tcl_Obj *eventProcObj = NULL;
-    Tcl_Obj *fileObj = NULL;
-    int line = -1;
-    TdbBreakpoint *matchedProcBp = NULL;
-    Tcl_HashEntry *matchedProcEntry = NULL;
+    Tcl_ResetResult(ip);
+    return value;
+}
 
-    /* Proc breakpoint check */
-    if (!state->haveProcBps) {
-        state->procFastRejects++;
-    } else {
-        /* Prefer objv[0] when available; fallback to token name */
-        if (cmdTok != NULL) {
-            /* Fully-qualified proc name */
-            Tcl_Obj *full = Tcl_NewObj(); Tcl_IncrRefCount(full);
-            Tcl_GetCommandFullName(ip, cmdTok, full);
-            eventProcObj = full;
-        } else if (objc > 0 && objv[0]) {
-            eventProcObj = objv[0]; Tcl_IncrRefCount(eventProcObj);
-        }
-        int matched = 0;
-        if (eventProcObj != NULL) {
-            const char *cand = Tcl_GetString(eventProcObj);
-            Tcl_HashSearch search;
-            Tcl_HashEntry *entry = Tcl_FirstHashEntry(&state->breakpoints, &search);
-            while (entry) {
-                TdbBreakpoint *bp = (TdbBreakpoint *)Tcl_GetHashValue(entry);
-                if (bp && bp->type == TDB_BP_PROC && bp->procName) {
-                    const char *bpName = Tcl_GetString(bp->procName);
-                    if (strcmp(cand, bpName) == 0) {
-                        matched = 1; matchedProcBp = bp; matchedProcEntry = entry; break;
-                    }
-                    if (bpName[0] == ':' && bpName[1] == ':' && cand[0] != ':') {
-                        if (strcmp(bpName+2, cand) == 0) { matched = 1; matchedProcBp = bp; matchedProcEntry = entry; break; }
-                    }
-                }
-                entry = Tcl_NextHashEntry(&search);
-            }
+/* [info frame] index of the deepest command at or below `from` that runs
+ * at absolute level `level` or outside it, skipping tdb's trace callbacks;
+ * 0 when there is none. With `level` -1 the bound is the caller of the
+ * innermost tdb command, i.e. the frame a shim proc stopped in. [info frame] also counts eval, uplevel and namespace eval, so proc
+ * levels cannot stand in for the index. */
+static int
+TdbStopFrameAt(TdbState *state, Tcl_Interp *ip, int level, int from)
+{
+    int cur = TdbInfoInt(state, ip, TDB_LIT(state, LEVEL));
+    if (cur < 0) return 0;
+    for (int i = from; i >= 1; i--) {
+        Tcl_Obj *words[3], *relObj = NULL, *cmdObj = NULL;
+        int rel = 0;
+        words[0] = TDB_LIT(state, INFO);
+        words[1] = TDB_LIT(state, FRAME);
+        words[2] = Tcl_NewIntObj(i);
+        Tcl_IncrRefCount(words[2]);
+        int rc = Tcl_EvalObjv(ip, 3, words, TCL_EVAL_DIRECT);
+        Tcl_DecrRefCount(words[2]);
+        if (rc != TCL_OK) break;
+        Tcl_Obj *fr = Tcl_GetObjResult(ip);
+        if (Tcl_DictObjGet(NULL, fr, TDB_LIT(state, LEVEL), &relObj) != TCL_OK || relObj == NULL ||
+            Tcl_GetIntFromObj(NULL, relObj, &rel) != TCL_OK) {
+            continue;
         }
-        if (!matched) {
-            state->procFastRejects++;
-        } else {
-            /* Defer proc breakpoint pausing to Tcl enterstep to ensure
-             * conditions and locals are evaluated in-frame. */
-        }
-    }
-
-    /* Object method breakpoint check: delegate to Tcl helper for conditions/log/hits */
-    if (state->methodBreakpointCount > 0 && objc >= 2) {
-        const char *objName = NULL;
-        const char *subcmd = NULL;
-        if (objv[0]) objName = Tcl_GetString(objv[0]);
-        if (objv[1]) subcmd = Tcl_GetString(objv[1]);
-        if (objName && subcmd) {
-            /* Scan and evaluate method breakpoints */
-            int matchedAny = 0;
-            int pauseOnMethod = 0;
-            int rmMethodId = 0;
-            int haveFrame = 0;
-            Tcl_HashSearch search;
-            Tcl_HashEntry *entry = Tcl_FirstHashEntry(&state->breakpoints, &search);
-            while (entry) {
-                TdbBreakpoint *bp = (TdbBreakpoint *)Tcl_GetHashValue(entry);
-                if (bp && bp->type == TDB_BP_METHOD && bp->methodPattern && bp->methodName) {
-                    const char *pat = Tcl_GetString(bp->methodPattern);
-                    const char *mname = Tcl_GetString(bp->methodName);
-                    if (Tcl_StringMatch(objName, pat) && (strcmp(subcmd, mname) == 0)) {
-                        matchedAny = 1;
-                        /* Evaluate condition/hit/log */
-                        /* Bump hits */
-                        bp->hits += 1;
-                        /* Build frame info if needed */
-                        if (!haveFrame) {
-                            state->isPaused = 1;
-                            Tcl_Obj *argv0[3];
-                            argv0[0] = Tcl_NewStringObj("info", -1);
-                            argv0[1] = Tcl_NewStringObj("frame", -1);
-                            argv0[2] = Tcl_NewStringObj("-1", -1);
-                            for (int i=0;i<3;i++) Tcl_IncrRefCount(argv0[i]);
-                            if (Tcl_EvalObjv(ip, 3, argv0, TCL_EVAL_GLOBAL|TCL_EVAL_DIRECT) == TCL_OK) {
-                                state->frameLookups++;
-                                if (frameDict) Tcl_DecrRefCount(frameDict);
-                                frameDict = Tcl_GetObjResult(ip);
-                                Tcl_IncrRefCount(frameDict);
-                            }
-                            state->isPaused = 0;
-                            for (int i=0;i<3;i++) Tcl_DecrRefCount(argv0[i]);
-                            haveFrame = 1;
-                        }
-                        /* Extract absolute level */
-                        int absLevel = 0;
-                        if (frameDict) {
-                            Tcl_Obj *lvl = NULL;
-                            if (Tcl_DictObjGet(ip, frameDict, Tcl_NewStringObj("level", -1), &lvl) == TCL_OK && lvl) {
-                                Tcl_GetIntFromObj(ip, lvl, &absLevel);
-                            }
-                        }
-                        /* Provide $cmd list to the condition frame */
-                        if (absLevel >= 0) {
-                            Tcl_Obj *setCmdScript[3];
-                            Tcl_Obj *cmdList = Tcl_NewListObj(0, NULL);
-                            for (int i = 0; i < objc; i++) {
-                                Tcl_ListObjAppendElement(ip, cmdList, objv[i]);
-                            }
-                            setCmdScript[0] = Tcl_NewStringObj("uplevel", -1);
-                            char lvbufset[32];
-                            snprintf(lvbufset, sizeof(lvbufset), "#%d", absLevel);
-                            setCmdScript[1] = Tcl_NewStringObj(lvbufset, -1);
-                            /* build: list set cmd $cmdList */
-                            Tcl_Obj *setList = Tcl_NewListObj(0, NULL);
-                            Tcl_ListObjAppendElement(ip, setList, Tcl_NewStringObj("set", -1));
-                            Tcl_ListObjAppendElement(ip, setList, Tcl_NewStringObj("cmd", -1));
-                            Tcl_ListObjAppendElement(ip, setList, cmdList);
-                            setCmdScript[2] = setList;
-                            for (int i=0;i<3;i++) Tcl_IncrRefCount(setCmdScript[i]);
-                            (void)Tcl_EvalObjv(ip, 3, setCmdScript, TCL_EVAL_GLOBAL|TCL_EVAL_DIRECT);
-                            for (int i=0;i<3;i++) Tcl_DecrRefCount(setCmdScript[i]);
-                        }
-
-                        /* Condition */
-                        int condOK = 1;
-                        if (bp->condition) {
-                            Tcl_Obj *ul[3];
-                            char lvbuf[32];
-                            ul[0] = Tcl_NewStringObj("uplevel", -1);
-                            snprintf(lvbuf, sizeof(lvbuf), "#%d", absLevel);
-                            ul[1] = Tcl_NewStringObj(lvbuf, -1);
-                            ul[2] = bp->condition;
-                            for (int i=0;i<3;i++) Tcl_IncrRefCount(ul[i]);
-                            if (Tcl_EvalObjv(ip, 3, ul, TCL_EVAL_GLOBAL|TCL_EVAL_DIRECT) != TCL_OK) {
-                                condOK = 0;
-                            } else {
-                                /* treat any non-empty true result as OK */
-                                condOK = 1;
-                            }
-                            for (int i=0;i<3;i++) Tcl_DecrRefCount(ul[i]);
-                        }
-                        if (!condOK) { entry = Tcl_NextHashEntry(&search); continue; }
-                        /* Hit-count */
-                        int hitOK = 1;
-                        if (bp->hitCountSpec) {
-                            hitOK = TdbHitSpecOk(Tcl_GetString(bp->hitCountSpec), bp->hits);
-                        }
-                        if (!hitOK) { entry = Tcl_NextHashEntry(&search); continue; }
-                        /* Log-only */
-                        if (bp->logMessage) {
-                            Tcl_Obj *ul2[4];
-                            char lvbuf2[32];
-                            ul2[0] = Tcl_NewStringObj("uplevel", -1);
-                            snprintf(lvbuf2, sizeof(lvbuf2), "#%d", absLevel);
-                            ul2[1] = Tcl_NewStringObj(lvbuf2, -1);
-                            ul2[2] = Tcl_NewStringObj("subst", -1);
-                            /* build list: subst -nocommands -nobackslashes $tmpl */
-                            Tcl_Obj *substCmd = Tcl_NewListObj(0, NULL);
-                            Tcl_ListObjAppendElement(ip, substCmd, Tcl_NewStringObj("subst", -1));
-                            Tcl_ListObjAppendElement(ip, substCmd, Tcl_NewStringObj("-nocommands", -1));
-                            Tcl_ListObjAppendElement(ip, substCmd, Tcl_NewStringObj("-nobackslashes", -1));
-                            Tcl_ListObjAppendElement(ip, substCmd, bp->logMessage);
-                            ul2[2] = substCmd;
-                            ul2[3] = NULL;
-                            Tcl_IncrRefCount(ul2[0]); Tcl_IncrRefCount(ul2[1]); Tcl_IncrRefCount(ul2[2]);
-                            if (Tcl_EvalObjv(ip, 3, ul2, TCL_EVAL_GLOBAL|TCL_EVAL_DIRECT) == TCL_OK) {
-                                Tcl_Obj *msg = Tcl_GetObjResult(ip);
-                                Tcl_IncrRefCount(msg);
-                                Tcl_Obj *putsCmd[2]; putsCmd[0] = Tcl_NewStringObj("puts", -1); putsCmd[1] = msg;
-                                Tcl_IncrRefCount(putsCmd[0]); Tcl_IncrRefCount(putsCmd[1]);
-                                (void)Tcl_EvalObjv(ip, 2, putsCmd, TCL_EVAL_GLOBAL|TCL_EVAL_DIRECT);
-                                Tcl_DecrRefCount(putsCmd[0]); Tcl_DecrRefCount(putsCmd[1]);
-                                Tcl_DecrRefCount(msg);
-                            }
-                            Tcl_DecrRefCount(ul2[0]); Tcl_DecrRefCount(ul2[1]); Tcl_DecrRefCount(ul2[2]);
-                            if (bp->oneshot) { rmMethodId = bp->id; }
-                            entry = Tcl_NextHashEntry(&search);
-                            continue;
-                        }
-                        /* Pause */
-                        pauseOnMethod = 1;
-                        if (bp->oneshot) { rmMethodId = bp->id; }
-                        break;
-                    }
+        int abs = cur - rel;
+        if (level >= 0 && abs > level) continue;
+        if (Tcl_DictObjGet(NULL, fr, TDB_LIT(state, CMD), &cmdObj) == TCL_OK && cmdObj) {
+            const char *cmd = Tcl_GetString(cmdObj);
+            if (strncmp(cmd, "::tdb::", 7) == 0 || strncmp(cmd, "tdb::", 5) == 0) {
+                /* Past the bound only trace callbacks (evals) are ours; a
+                 * traced tdb command is the paused one */
+                Tcl_Obj *typeObj = NULL;
+                if (level < 0) {
+                    level = abs - 1;
+                    continue;
+                }
+                if (Tcl_DictObjGet(NULL, fr, TDB_LIT(state, TYPE), &typeObj) == TCL_OK && typeObj &&
+                    strcmp(Tcl_GetString(typeObj), "eval") == 0) {
+                    continue;
                 }
-                entry = Tcl_NextHashEntry(&search);
-            }
-            if (pauseOnMethod) {
-                doPause = 1;
-            }
-            /* If we paused and need to remove a oneshot, do it after event publication */
-            if (rmMethodId > 0) {
-                /* Store id in eventProcObj temporarily for cleanup below; or schedule rm after event */
-                /* We will perform removal after Tdb_SetStopEvent using a small eval. */
-            }
-        }
-    }
-
-    /* File:line matching handled by Tcl exec traces when file bps exist */
-    if (!doPause && state->haveFileLineBps) {
-        state->fileFastRejects++;
-    }
-
-    if (doPause) {
-        /* Build event dict using current frame */
-        if (!frameDict) {
-            state->isPaused = 1;
-            Tcl_Obj *argv0[3];
-            argv0[0] = Tcl_NewStringObj("info", -1);
-            argv0[1] = Tcl_NewStringObj("frame", -1);
-            argv0[2] = Tcl_NewStringObj("-1", -1);
-            for (int i=0;i<3;i++) Tcl_IncrRefCount(argv0[i]);
-            if (Tcl_EvalObjv(ip, 3, argv0, TCL_EVAL_GLOBAL|TCL_EVAL_DIRECT) == TCL_OK) {
-                state->frameLookups++;
-                frameDict = Tcl_GetObjResult(ip);
-                Tcl_IncrRefCount(frameDict);
             }
-            state->isPaused = 0;
-            for (int i=0;i<3;i++) Tcl_DecrRefCount(argv0[i]);
         }
-        Tcl_Obj *event = frameDict ? Tcl_DuplicateObj(frameDict) : Tcl_NewDictObj();
-        Tcl_IncrRefCount(event);
-        Tcl_DictObjPut(ip, event, Tcl_NewStringObj("event", -1), Tcl_NewStringObj("stopped", -1));
-        Tcl_DictObjPut(ip, event, Tcl_NewStringObj("reason", -1), Tcl_NewStringObj("breakpoint", -1));
-        if (eventProcObj) {
-            Tcl_DictObjPut(ip, event, Tcl_NewStringObj("proc", -1), eventProcObj);
-            Tcl_IncrRefCount(eventProcObj);
-            Tcl_DecrRefCount(eventProcObj);
-        }
-        Tdb_SetStopEvent(ip, event);
-        /* Nudge any pending tdb::wait vwait by scheduling a microtask to set ::tdb::__woke */
-        Tcl_EvalEx(ip, "if {[llength [info commands ::tdb::wait]]} { after 0 { if {[info exists ::tdb::_stopped] && [info exists ::tdb::__woke]} { set ::tdb::__woke 1 } } }", -1, TCL_EVAL_GLOBAL);
-        Tcl_DecrRefCount(event);
-        /* If method oneshot removal was requested, perform it now */
-        (void)ip; /* ip is available */
-        /* We can't know rmMethodId here directly; recompute minimal removal by checking lastStop */
+        Tcl_ResetResult(ip);
+        return i;
     }
-
-    if (frameDict) Tcl_DecrRefCount(frameDict);
-    if (eventProcObj) Tcl_DecrRefCount(eventProcObj);
-    return TCL_OK;
+    Tcl_ResetResult(ip);
+    return 0;
 }
 
-static void
-Tdb_RemoveObjTrace(Tcl_Interp *interp)
+/* Name of the running coroutine ("" outside one, or on Tcl 8.5); new object */
+static Tcl_Obj *
+TdbCurrentCoroutine(Tcl_Interp *interp)
 {
     TdbState *state = TdbGetState(interp);
-    if (state->objTrace != NULL) {
-        Tcl_DeleteTrace(interp, state->objTrace);
-        state->objTrace = NULL;
+    Tcl_Obj *coro = NULL;
+    Tcl_Obj *argv0[2];
+    Tcl_InterpState saved = Tcl_SaveInterpState(interp, TCL_OK);
+    argv0[0] = TDB_LIT(state, QINFO);
+    argv0[1] = TDB_LIT(state, COROUTINE);
+    if (Tcl_EvalObjv(interp, 2, argv0, TCL_EVAL_DIRECT) == TCL_OK) {
+        coro = Tcl_GetObjResult(interp);
     }
+    coro = coro ? Tcl_DuplicateObj(coro) : Tcl_NewObj();
+    Tcl_RestoreInterpState(interp, saved);
+    return coro;
 }
 
+/* ----------------------------------------------------------------------
+ * Pause/resume plumbing
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Stop and log events are kept in a bounded FIFO on the state.  Publishing
+ * never evaluates script: when a tdb::wait is blocked in the notifier or a
+ * tdb::on callback is registered, a single TdbWakeEvent is queued with
+ * Tcl_QueueEvent and the notifier is alerted.  ::tdb::_stopped mirrors the
+ * oldest pending stop for older scripts; unsetting it discards that stop
+ * only, and the next pending one is mirrored from the idle loop.  Stops are
+ * never shed: past -events.max only log and degraded events are dropped.
+ */
+
+typedef struct {
+    Tcl_Event header;
+    TdbState *state;
+} TdbWakeEvent;
+
+static char *TdbStoppedUnsetTrace(ClientData cd, Tcl_Interp *interp, const char *name1, const char *name2, int flags);
+
 static void
-Tdb_InstallObjTrace(Tcl_Interp *interp)
+TdbEventFree(TdbQueuedEvent *qe)
 {
-    TdbState *state = TdbGetState(interp);
-    if (state->objTrace != NULL) return;
-    int flags = 0;
-    if (state->perfAllowInline) flags |= TCL_ALLOW_INLINE_COMPILATION;
-    state->objTrace = Tcl_CreateObjTrace(interp, 0, flags, Tdb_ObjTraceProc, state, NULL);
+    Tcl_DecrRefCount(qe->dict);
+    if (qe->locals) Tcl_DecrRefCount(qe->locals);
+    ckfree(qe);
 }
 
+/* Drop queued events of one kind, or all of them when kind < 0. Dropping
+ * a stop loses a delta, so every frame starts over with a full snapshot. */
 static void
-Tdb_RecomputeTracing(Tcl_Interp *interp)
+TdbEventQueueClear(TdbState *state, int kind)
 {
-    TdbState *state = TdbGetState(interp);
-    int needObjTrace = state->started && (state->haveProcBps || state->methodBreakpointCount > 0);
-    if (needObjTrace) {
-        Tdb_InstallObjTrace(interp);
-    } else {
-        Tdb_RemoveObjTrace(interp);
-    }
-    if (state->started && (state->haveFileLineBps || state->haveProcBps)) {
-        /* Attach Tcl exec traces for file:line and proc-level fallback */
-        Tcl_EvalEx(interp, "if {[llength [info commands ::tdb::_ensure_exec_traces]]} {::tdb::_ensure_exec_traces}", -1, TCL_EVAL_GLOBAL);
+    TdbQueuedEvent **link = &state->eventHead;
+    int droppedStop = 0;
+    state->eventTail = NULL;
+    while (*link) {
+        TdbQueuedEvent *qe = *link;
+        if (kind < 0 || qe->kind == (TdbEventKind)kind) {
+            *link = qe->next;
+            state->eventCount--;
+            if (qe->kind == TDB_EV_STOPPED) droppedStop = 1;
+            TdbEventFree(qe);
+        } else {
+            state->eventTail = qe;
+            link = &qe->next;
+        }
     }
+    if (droppedStop) TdbLocalsReset(state);
 }
 
-/* tdb::_match_fileline file line -> 1/0 */
-static int
-TdbMatchFileLineCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+/* Unlink and return the oldest event of a kind (kind < 0: any), or NULL */
+static TdbQueuedEvent *
+TdbEventQueueTake(TdbState *state, int kind)
 {
-    (void)cd;
-    if (objc != 3) {
-        Tcl_WrongNumArgs(interp, 1, objv, "file line");
-        return TCL_ERROR;
-    }
-    TdbState *state = TdbGetState(interp);
-    Tcl_Obj *fileObj = objv[1];
-    int line = -1;
-    if (Tcl_GetIntFromObj(interp, objv[2], &line) != TCL_OK) return TCL_ERROR;
-    if (line <= 0) { Tcl_SetObjResult(interp, Tcl_NewIntObj(0)); return TCL_OK; }
-    /* normalize */
-    Tcl_Obj *norm = Tcl_FSGetNormalizedPath(interp, fileObj);
-    if (norm) fileObj = norm;
-    int match = 0;
-    Tcl_HashSearch search; Tcl_HashEntry *entry = Tcl_FirstHashEntry(&state->breakpoints, &search);
-    while (entry) {
-        TdbBreakpoint *bp = (TdbBreakpoint *)Tcl_GetHashValue(entry);
-        if (bp && bp->type == TDB_BP_FILE && bp->filePath && bp->line == line) {
-            if (Tcl_FSEqualPaths(bp->filePath, fileObj)) { match = 1; break; }
+    TdbQueuedEvent **link = &state->eventHead, *prev = NULL;
+    while (*link) {
+        TdbQueuedEvent *qe = *link;
+        if (kind < 0 || qe->kind == (TdbEventKind)kind) {
+            *link = qe->next;
+            if (state->eventTail == qe) state->eventTail = prev;
+            state->eventCount--;
+            qe->next = NULL;
+            return qe;
         }
-        entry = Tcl_NextHashEntry(&search);
+        prev = qe;
+        link = &qe->next;
     }
-    Tcl_SetObjResult(interp, Tcl_NewIntObj(match));
-    return TCL_OK;
+    return NULL;
 }
 
-/* stats command */
-static int
-TdbStatsCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+static TdbQueuedEvent *
+TdbEventQueueFind(TdbState *state, int kind)
 {
-    (void)cd;
-    if (objc != 1) {
-        Tcl_WrongNumArgs(interp, 1, objv, NULL);
-        return TCL_ERROR;
+    for (TdbQueuedEvent *qe = state->eventHead; qe; qe = qe->next) {
+        if (kind < 0 || qe->kind == (TdbEventKind)kind) return qe;
     }
-    TdbState *state = TdbGetState(interp);
-    Tcl_Obj *dict = Tcl_NewDictObj();
-    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("tracing", -1), Tcl_NewIntObj(state->objTrace != NULL));
-    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("traceHits", -1), Tcl_NewIntObj(state->traceHits));
-    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("frameLookups", -1), Tcl_NewIntObj(state->frameLookups));
-    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("procFastRejects", -1), Tcl_NewIntObj(state->procFastRejects));
-    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("fileFastRejects", -1), Tcl_NewIntObj(state->fileFastRejects));
-    Tcl_SetObjResult(interp, dict);
-    return TCL_OK;
+    return NULL;
 }
 
-/* tdb::_stop_event <dict> -- internal helper used by Tcl shim to publish
- * a fully-formed stop event dict (used by exec-trace path for file:line). */
-static int
-TdbStopEventCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+/* Point ::tdb::_stopped at the oldest pending stop, or unset it */
+static void
+TdbSyncStoppedVar(TdbState *state)
 {
-    (void)cd;
-    if (objc != 2) {
-        Tcl_WrongNumArgs(interp, 1, objv, "eventDict");
-        return TCL_ERROR;
+    Tcl_Interp *interp = state->interp;
+    TdbQueuedEvent *qe = TdbEventQueueFind(state, TDB_EV_STOPPED);
+    state->syncingStopped = 1;
+    Tcl_UntraceVar2(interp, TDB_GLOBAL_VAR_STOPPED, NULL, TCL_GLOBAL_ONLY|TCL_TRACE_UNSETS, TdbStoppedUnsetTrace, state);
+    if (qe) {
+        Tcl_SetVar2Ex(interp, TDB_GLOBAL_VAR_STOPPED, NULL, qe->dict, TCL_GLOBAL_ONLY);
+        Tcl_TraceVar2(interp, TDB_GLOBAL_VAR_STOPPED, NULL, TCL_GLOBAL_ONLY|TCL_TRACE_UNSETS, TdbStoppedUnsetTrace, state);
+    } else {
+        Tcl_UnsetVar(interp, TDB_GLOBAL_VAR_STOPPED, TCL_GLOBAL_ONLY);
     }
-    if (Tcl_DictObjSize(interp, objv[1], NULL) != TCL_OK) {
-        Tcl_SetObjResult(interp, Tcl_NewStringObj("expected dict", -1));
-        return TCL_ERROR;
+    state->syncingStopped = 0;
+}
+
+static char *
+TdbStoppedUnsetTrace(ClientData cd, Tcl_Interp *interp, const char *name1, const char *name2, int flags)
+{
+    (void)interp; (void)name1; (void)name2;
+    TdbState *state = (TdbState *)cd;
+    if ((flags & TCL_INTERP_DESTROYED) || state->syncingStopped) return NULL;
+    /* Script consumed the mirrored stop; later stops stay queued */
+    TdbQueuedEvent *qe = TdbEventQueueTake(state, TDB_EV_STOPPED);
+    if (qe) TdbEventFree(qe);
+    if (!state->stoppedIdle && TdbEventQueueFind(state, TDB_EV_STOPPED)) {
+        state->stoppedIdle = 1;
+        Tcl_DoWhenIdle(TdbStoppedIdleProc, state);
     }
-    Tdb_SetStopEvent(interp, objv[1]);
-    Tcl_SetObjResult(interp, Tcl_NewStringObj("ok", -1));
-    return TCL_OK;
+    return NULL;
 }
 
-/* ----------------------------------------------------------------------
- * Commands: config, start/stop, breakpoint API, _pauseNow
- * ---------------------------------------------------------------------- */
+static void
+TdbStoppedIdleProc(ClientData cd)
+{
+    TdbState *state = (TdbState *)cd;
+    state->stoppedIdle = 0;
+    TdbSyncStoppedVar(state);
+}
+
+static void TdbDispatchCallbacks(TdbState *state);
 
 static int
-TdbConfigExport(TdbState *state, Tcl_Interp *interp)
+TdbWakeEventProc(Tcl_Event *evPtr, int flags)
 {
-    Tcl_Obj *dict = Tcl_NewDictObj();
-    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("-perf.allowInline", -1), Tcl_NewIntObj(state->perfAllowInline));
-    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("-path.normalize", -1), Tcl_NewIntObj(state->pathNormalize));
-    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("-safeEval", -1), Tcl_NewIntObj(state->safeEval));
-    Tcl_SetObjResult(interp, dict);
-    return TCL_OK;
+    (void)flags;
+    TdbState *state = ((TdbWakeEvent *)evPtr)->state;
+    state->wakePending = 0;
+    TdbDispatchCallbacks(state);
+    return 1;
 }
 
 static int
-TdbConfigCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+TdbWakeEventDeleteProc(Tcl_Event *evPtr, ClientData clientData)
 {
-    (void)cd;
-    TdbState *state = TdbGetState(interp);
-    if (objc == 1) return TdbConfigExport(state, interp);
-    if (((objc - 1) % 2) != 0) {
-        Tcl_WrongNumArgs(interp, 1, objv, "?-option value ...?");
-        Tcl_SetErrorCode(interp, "TDB", "CONFIG", "USAGE", NULL);
-        return TCL_ERROR;
-    }
-    for (int i = 1; i < objc; i += 2) {
-        const char *opt = Tcl_GetString(objv[i]);
-        int b;
-        if (strcmp(opt, "-perf.allowInline") == 0) {
-            if (Tcl_GetBooleanFromObj(interp, objv[i+1], &b) != TCL_OK) {
-                Tcl_SetErrorCode(interp, "TDB", "CONFIG", "VALUE", NULL);
-                return TCL_ERROR;
-            }
-            state->perfAllowInline = b ? 1 : 0;
-        } else if (strcmp(opt, "-path.normalize") == 0) {
-            if (Tcl_GetBooleanFromObj(interp, objv[i+1], &b) != TCL_OK) {
-                Tcl_SetErrorCode(interp, "TDB", "CONFIG", "VALUE", NULL);
-                return TCL_ERROR;
-            }
-            state->pathNormalize = b ? 1 : 0;
-        } else if (strcmp(opt, "-safeEval") == 0) {
-            if (Tcl_GetBooleanFromObj(interp, objv[i+1], &b) != TCL_OK) {
-                Tcl_SetErrorCode(interp, "TDB", "CONFIG", "VALUE", NULL);
-                return TCL_ERROR;
-            }
-            state->safeEval = b ? 1 : 0;
-        } else {
-            return TdbError(interp, "CONFIG", "OPTION", "unknown configuration option");
+    return evPtr->proc == TdbWakeEventProc && ((TdbWakeEvent *)evPtr)->state == (TdbState *)clientData;
+}
+
+static void
+TdbWakeController(TdbState *state)
+{
+    if (state->wakePending) return;
+    TdbWakeEvent *wake = (TdbWakeEvent *)ckalloc(sizeof(TdbWakeEvent));
+    wake->header.proc = TdbWakeEventProc;
+    wake->state = state;
+    state->wakePending = 1;
+    Tcl_QueueEvent((Tcl_Event *)wake, TCL_QUEUE_TAIL);
+    Tcl_ThreadAlert(Tcl_GetCurrentThread());
+}
+
+/* Queue an event; `locals` is the full snapshot behind a stop's delta */
+static void
+TdbEventPushLocals(TdbState *state, TdbEventKind kind, Tcl_Obj *eventDict, Tcl_Obj *locals)
+{
+    TdbQueuedEvent *qe = (TdbQueuedEvent *)ckalloc(sizeof(TdbQueuedEvent));
+    qe->next = NULL;
+    qe->kind = kind;
+    qe->dict = eventDict;
+    Tcl_IncrRefCount(eventDict);
+    qe->locals = locals;
+    if (locals) Tcl_IncrRefCount(locals);
+    if (state->eventTail) state->eventTail->next = qe; else state->eventHead = qe;
+    state->eventTail = qe;
+    state->eventCount++;
+    /* Bounded: shed the oldest log event, then the oldest degraded event;
+     * stops are kept past the bound and counted instead */
+    while (state->eventCount > state->eventQueueMax) {
+        TdbQueuedEvent *old = TdbEventQueueTake(state, TDB_EV_LOG);
+        if (!old) old = TdbEventQueueTake(state, TDB_EV_DEGRADED);
+        if (!old) {
+            if (kind == TDB_EV_STOPPED) state->eventsOverrun++;
+            break;
         }
+        TdbEventFree(old);
+        state->eventsDropped++;
     }
-    return TdbConfigExport(state, interp);
+    if (kind == TDB_EV_STOPPED) TdbSyncStoppedVar(state);
+    if (state->waiters > 0 || state->onEvent[kind]) TdbWakeController(state);
 }
 
-static int
-TdbStartCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+static void
+TdbEventPush(TdbState *state, TdbEventKind kind, Tcl_Obj *eventDict)
 {
-    (void)cd;
-    if (objc != 1) {
+    TdbEventPushLocals(state, kind, eventDict, NULL);
+}
+
+/* Hand queued events to tdb::on callbacks; runs from the notifier only */
+static void
+TdbDispatchCallbacks(TdbState *state)
+{
+    Tcl_Interp *interp = state->interp;
+    Tcl_Preserve(interp);
+    for (;;) {
+        TdbQueuedEvent *qe = NULL;
+        Tcl_Obj *prefix = NULL;
+        for (qe = state->eventHead; qe; qe = qe->next) {
+            if (state->onEvent[qe->kind]) break;
+        }
+        if (!qe) break;
+        prefix = state->onEvent[qe->kind];
+        qe = TdbEventQueueTake(state, qe->kind);
+        if (qe->kind == TDB_EV_STOPPED) TdbSyncStoppedVar(state);
+        TdbLocalsDeliver(state, qe);
+        Tcl_Obj *cmd = Tcl_DuplicateObj(prefix);
+        Tcl_IncrRefCount(cmd);
+        Tcl_ListObjAppendElement(interp, cmd, qe->dict);
+        if (Tcl_EvalObjEx(interp, cmd, TCL_EVAL_GLOBAL) != TCL_OK) {
+            Tcl_BackgroundError(interp);
+        }
+        Tcl_DecrRefCount(cmd);
+        TdbEventFree(qe);
+    }
+    Tcl_Release(interp);
+}
+
+/* ----------------------------------------------------------------------
+ * Locals deltas
+ *
+ * A stop event carries only the locals that were added, changed or removed
+ * since the previous stop in the same frame invocation. A proc frame is
+ * identified by its level, coroutine and call site (the [info frame] index,
+ * file and line of the command that called it, and the name it used), so
+ * a call from another place starts over while the debuggee's frames stay
+ * untouched. Calls of one proc from one site, as in a loop, share an id
+ * and chain their deltas. Holding the
+ * previous snapshot keeps every
+ * captured value shared, so a variable that was written since holds a
+ * different Tcl_Obj: equal pointers mean unchanged, and only differing
+ * pointers need a string comparison.
+ * ---------------------------------------------------------------------- */
+
+static void
+TdbLocalsSetCurrent(TdbState *state, Tcl_Obj *locals, Tcl_Obj *delta)
+{
+    if (locals) Tcl_IncrRefCount(locals);
+    if (delta) Tcl_IncrRefCount(delta);
+    if (state->lastLocals) Tcl_DecrRefCount(state->lastLocals);
+    if (state->lastDelta) Tcl_DecrRefCount(state->lastDelta);
+    state->lastLocals = locals;
+    state->lastDelta = delta;
+}
+
+/* Forget every frame's snapshot; the next stop in any frame is full */
+static void
+TdbLocalsReset(TdbState *state)
+{
+    Tcl_HashSearch search;
+    Tcl_HashEntry *entry;
+    for (entry = Tcl_FirstHashEntry(&state->localsFrames, &search); entry; entry = Tcl_NextHashEntry(&search)) {
+        TdbFrameLocals *fl = (TdbFrameLocals *)Tcl_GetHashValue(entry);
+        if (fl->frameId) Tcl_DecrRefCount(fl->frameId);
+        if (fl->procName) Tcl_DecrRefCount(fl->procName);
+        if (fl->snapshot) Tcl_DecrRefCount(fl->snapshot);
+        ckfree(fl);
+    }
+    Tcl_DeleteHashTable(&state->localsFrames);
+    Tcl_InitHashTable(&state->localsFrames, TCL_STRING_KEYS);
+    TdbLocalsSetCurrent(state, NULL, NULL);
+}
+
+/* A stop handed to tdb::wait or a tdb::on callback becomes the one that
+ * tdb::locals -full and -delta describe */
+static void
+TdbLocalsDeliver(TdbState *state, TdbQueuedEvent *qe)
+{
+    Tcl_Obj *delta = NULL;
+    if (qe->kind != TDB_EV_STOPPED) return;
+    if (qe->locals) Tcl_DictObjGet(NULL, qe->dict, TDB_LIT(state, LOCALSDELTA), &delta);
+    TdbLocalsSetCurrent(state, qe->locals, delta);
+}
+
+/* Call site of the proc frame at `level`: "index file:line name", the
+ * [info frame] index and place of the deepest command at level-1 below the
+ * paused command at index `stopFrame`, and the name it called the proc by.
+ * Returns a new object, or NULL when it is not found. */
+static Tcl_Obj *
+TdbFrameCallSite(TdbState *state, Tcl_Interp *interp, int level, int stopFrame)
+{
+    Tcl_InterpState saved = Tcl_SaveInterpState(interp, TCL_OK);
+    Tcl_Obj *site = NULL;
+    int from = stopFrame > 0 ? stopFrame - 1 : TdbInfoInt(state, interp, TDB_LIT(state, FRAME));
+    int index = TdbStopFrameAt(state, interp, level - 1, from);
+    if (index > 0) {
+        Tcl_Obj *words[3], *fileObj = NULL, *lineObj = NULL, *name = NULL;
+        words[0] = TDB_LIT(state, INFO);
+        words[1] = TDB_LIT(state, FRAME);
+        words[2] = Tcl_NewIntObj(index);
+        Tcl_IncrRefCount(words[2]);
+        if (Tcl_EvalObjv(interp, 3, words, TCL_EVAL_DIRECT) == TCL_OK) {
+            Tcl_Obj *fr = Tcl_GetObjResult(interp);
+            Tcl_DictObjGet(NULL, fr, TDB_LIT(state, FILE), &fileObj);
+            Tcl_DictObjGet(NULL, fr, TDB_LIT(state, LINE), &lineObj);
+            site = Tcl_ObjPrintf("%d %s:%s", index, fileObj ? Tcl_GetString(fileObj) : "",
+                                 lineObj ? Tcl_GetString(lineObj) : "");
+            Tcl_IncrRefCount(site);
+        }
+        Tcl_DecrRefCount(words[2]);
+        words[1] = TDB_LIT(state, LEVEL);
+        words[2] = Tcl_NewIntObj(level);
+        Tcl_IncrRefCount(words[2]);
+        if (site && Tcl_EvalObjv(interp, 3, words, TCL_EVAL_DIRECT) == TCL_OK &&
+            Tcl_ListObjIndex(NULL, Tcl_GetObjResult(interp), 0, &name) == TCL_OK && name) {
+            Tcl_AppendToObj(site, " ", 1);
+            Tcl_AppendObjToObj(site, name);
+        }
+        Tcl_DecrRefCount(words[2]);
+    }
+    Tcl_RestoreInterpState(interp, saved);
+    return site;
+}
+
+static int
+TdbObjEqual(Tcl_Obj *a, Tcl_Obj *b)
+{
+    if (a == b) return 1;
+    int la = 0, lb = 0;
+    const char *sa = Tcl_GetStringFromObj(a, &la);
+    const char *sb = Tcl_GetStringFromObj(b, &lb);
+    return la == lb && memcmp(sa, sb, (size_t)la) == 0;
+}
+
+/* Diff `locals` against the frame's previous snapshot and remember it.
+ * Returns {full 0|1 frame id seq n base m added dict changed dict removed
+ * list}, or NULL when `locals` is not a dict. seq counts the stops in the
+ * frame and base is the seq the delta applies to. full=1 (base 0) means
+ * there was no usable base and `added` holds every variable. */
+static Tcl_Obj *
+TdbLocalsDelta(TdbState *state, Tcl_Interp *interp, Tcl_Obj *eventDict, Tcl_Obj *locals, int level, int stopFrame)
+{
+    int size = 0;
+    if (Tcl_DictObjSize(NULL, locals, &size) != TCL_OK) return NULL;
+
+    Tcl_Obj *coro = NULL, *levelObj = NULL, *proc = NULL, *frameId = NULL;
+    Tcl_DictObjGet(NULL, eventDict, TDB_LIT(state, COROUTINE), &coro);
+    Tcl_DictObjGet(NULL, eventDict, TDB_LIT(state, LEVEL), &levelObj);
+    Tcl_DictObjGet(NULL, eventDict, TDB_LIT(state, PROC), &proc);
+    if (level < 0 && levelObj) Tcl_GetIntFromObj(NULL, levelObj, &level);
+
+    if (state->localsFrames.numEntries >= TDB_LOCALS_FRAMES_MAX) {
+        /* Mostly frames that have returned; start over rather than track them */
+        TdbLocalsReset(state);
+    }
+    if (level > 0 && proc && Tcl_GetCharLength(proc) > 0) {
+        Tcl_Obj *site = TdbFrameCallSite(state, interp, level, stopFrame);
+        if (site) {
+            frameId = Tcl_ObjPrintf("%d %s %s", level, coro ? Tcl_GetString(coro) : "", Tcl_GetString(site));
+            Tcl_IncrRefCount(frameId);
+            Tcl_DecrRefCount(site);
+        }
+    }
+    if (frameId == NULL) {
+        /* Global or namespace frames: one per level and coroutine */
+        frameId = Tcl_ObjPrintf("%s %s", levelObj ? Tcl_GetString(levelObj) : "",
+                                coro ? Tcl_GetString(coro) : "");
+        Tcl_IncrRefCount(frameId);
+    }
+    int isNew = 0;
+    Tcl_HashEntry *entry = Tcl_CreateHashEntry(&state->localsFrames, Tcl_GetString(frameId), &isNew);
+
+    TdbFrameLocals *fl;
+    Tcl_Obj *prev = NULL;
+    if (isNew) {
+        fl = (TdbFrameLocals *)ckalloc(sizeof(TdbFrameLocals));
+        memset(fl, 0, sizeof(TdbFrameLocals));
+        fl->frameId = frameId;
+        Tcl_IncrRefCount(frameId);
+        Tcl_SetHashValue(entry, fl);
+    } else {
+        fl = (TdbFrameLocals *)Tcl_GetHashValue(entry);
+        /* A different proc at this level shares no variables with the old one */
+        if (strcmp(Tcl_GetString(fl->procName), proc ? Tcl_GetString(proc) : "") == 0) {
+            prev = fl->snapshot;
+        }
+    }
+    Tcl_DecrRefCount(frameId);
+
+    Tcl_Obj *added = Tcl_NewDictObj();
+    Tcl_Obj *changed = Tcl_NewDictObj();
+    Tcl_Obj *removed = Tcl_NewListObj(0, NULL);
+    Tcl_DictSearch search;
+    Tcl_Obj *name, *value, *old;
+    int done = 0;
+    if (Tcl_DictObjFirst(NULL, locals, &search, &name, &value, &done) == TCL_OK) {
+        for (; !done; Tcl_DictObjNext(&search, &name, &value, &done)) {
+            old = NULL;
+            if (prev) Tcl_DictObjGet(NULL, prev, name, &old);
+            if (old == NULL) {
+                Tcl_DictObjPut(NULL, added, name, value);
+            } else if (!TdbObjEqual(old, value)) {
+                Tcl_DictObjPut(NULL, changed, name, value);
+            }
+        }
+        Tcl_DictObjDone(&search);
+    }
+    if (prev && Tcl_DictObjFirst(NULL, prev, &search, &name, &value, &done) == TCL_OK) {
+        for (; !done; Tcl_DictObjNext(&search, &name, &value, &done)) {
+            old = NULL;
+            Tcl_DictObjGet(NULL, locals, name, &old);
+            if (old == NULL) Tcl_ListObjAppendElement(NULL, removed, name);
+        }
+        Tcl_DictObjDone(&search);
+    }
+
+    Tcl_Obj *delta = Tcl_NewDictObj();
+    Tcl_DictObjPut(NULL, delta, TDB_LIT(state, FULL), Tcl_NewBooleanObj(prev == NULL));
+    Tcl_DictObjPut(NULL, delta, TDB_LIT(state, FRAME), fl->frameId);
+    Tcl_DictObjPut(NULL, delta, TDB_LIT(state, SEQ), Tcl_NewIntObj(fl->seq + 1));
+    Tcl_DictObjPut(NULL, delta, TDB_LIT(state, BASE), Tcl_NewIntObj(prev ? fl->seq : 0));
+    Tcl_DictObjPut(NULL, delta, TDB_LIT(state, ADDED), added);
+    Tcl_DictObjPut(NULL, delta, TDB_LIT(state, CHANGED), changed);
+    Tcl_DictObjPut(NULL, delta, TDB_LIT(state, REMOVED), removed);
+
+    fl->seq++;
+    Tcl_IncrRefCount(locals);
+    if (fl->snapshot) Tcl_DecrRefCount(fl->snapshot);
+    fl->snapshot = locals;
+    Tcl_Obj *procName = proc ? proc : Tcl_NewObj();
+    Tcl_IncrRefCount(procName);
+    if (fl->procName) Tcl_DecrRefCount(fl->procName);
+    fl->procName = procName;
+    TdbLocalsSetCurrent(state, locals, delta);
+    return delta;
+}
+
+/* Publish a stop. `frameLevel` is the absolute level of the frame whose
+ * locals the event carries, or -1 when the event's level already is;
+ * `stopFrame` is the paused command's [info frame] index for tdb::frames. */
+static void
+Tdb_SetStopEvent(Tcl_Interp *interp, Tcl_Obj *eventDict, int frameLevel, int stopFrame)
+{
+    TdbState *state = TdbGetState(interp);
+    /* Tag the stop with the coroutine it came from */
+    Tcl_Obj *coro = NULL;
+    if (Tcl_DictObjGet(NULL, eventDict, TDB_LIT(state, COROUTINE), &coro) == TCL_OK && coro == NULL) {
+        if (Tcl_IsShared(eventDict)) eventDict = Tcl_DuplicateObj(eventDict);
+        Tcl_DictObjPut(NULL, eventDict, TDB_LIT(state, COROUTINE), TdbCurrentCoroutine(interp));
+    }
+    /* Replace a full locals snapshot with its delta against the last stop;
+     * the queued event keeps the snapshot for tdb::locals -full */
+    Tcl_Obj *locals = NULL, *snapshot = NULL;
+    if (Tcl_DictObjGet(NULL, eventDict, TDB_LIT(state, LOCALS), &locals) == TCL_OK && locals != NULL) {
+        Tcl_IncrRefCount(locals);
+        Tcl_Obj *delta = TdbLocalsDelta(state, interp, eventDict, locals, frameLevel, stopFrame);
+        if (delta) {
+            if (Tcl_IsShared(eventDict)) eventDict = Tcl_DuplicateObj(eventDict);
+            Tcl_DictObjRemove(NULL, eventDict, TDB_LIT(state, LOCALS));
+            Tcl_DictObjPut(NULL, eventDict, TDB_LIT(state, LOCALSDELTA), delta);
+            snapshot = locals;
+        }
+    }
+    if (snapshot == NULL) TdbLocalsSetCurrent(state, NULL, NULL);
+    Tcl_IncrRefCount(eventDict);
+    if (state->lastStopDict) Tcl_DecrRefCount(state->lastStopDict);
+    state->lastStopDict = eventDict;
+    state->stopFrame = stopFrame;
+
+    Tcl_SetVar2Ex(interp, TDB_GLOBAL_VAR_LAST_STOP, NULL, eventDict, TCL_GLOBAL_ONLY);
+    TdbEventPushLocals(state, TDB_EV_STOPPED, eventDict, snapshot);
+    if (locals) Tcl_DecrRefCount(locals);
+}
+
+static void
+Tdb_EnterPauseLoop(Tcl_Interp *interp)
+{
+    TdbState *state = TdbGetState(interp);
+    if (state->isPaused) return; /* re-entrancy guard */
+    state->isPaused = 1;
+    if (Tcl_EvalEx(interp, "vwait ::tdb::_resume", -1, TCL_EVAL_GLOBAL) != TCL_OK) {
+        Tcl_BackgroundError(interp);
+    }
+    Tcl_UnsetVar(interp, TDB_GLOBAL_VAR_RESUME, TCL_GLOBAL_ONLY);
+    state->isPaused = 0;
+}
+
+/* ----------------------------------------------------------------------
+ * Overhead budget (-perf.budget)
+ *
+ * A candidate hit is charged to its breakpoint from admission until the
+ * hit is decided: the [info frame] lookup, the shim dispatch, conditions,
+ * log templates and publishing the stop. Once a window of wall time has passed, a
+ * breakpoint whose share exceeds the budget is sampled (evaluated on every
+ * Nth candidate hit only); a sampled one that is still over is disabled.
+ * Each step publishes a `degraded` event.
+ * ---------------------------------------------------------------------- */
+
+static Tcl_WideInt
+TdbNowNs(void)
+{
+#if defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+        return (Tcl_WideInt)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+#endif
+    Tcl_Time t;
+    Tcl_GetTime(&t);
+    return (Tcl_WideInt)t.sec * 1000000000 + (Tcl_WideInt)t.usec * 1000;
+}
+
+/* Whether this candidate hit is evaluated. *startPtr receives the start
+ * time to charge from, or 0 when no budget is configured. */
+static int
+TdbBudgetAdmit(TdbState *state, TdbBreakpoint *bp, Tcl_WideInt *startPtr)
+{
+    *startPtr = 0;
+    if (bp->disabled) return 0;
+    if (bp->sampleEvery > 1 && (++bp->sampleTick % (unsigned int)bp->sampleEvery) != 0) return 0;
+    if (state->perfBudget > 0) *startPtr = TdbNowNs();
+    return 1;
+}
+
+static void
+TdbBudgetDegrade(TdbState *state, TdbBreakpoint *bp, double pct)
+{
+    Tcl_Obj *ev = Tcl_NewDictObj();
+    Tcl_IncrRefCount(ev);
+    Tcl_DictObjPut(NULL, ev, TDB_LIT(state, EVENT), TDB_LIT(state, DEGRADED));
+    Tcl_DictObjPut(NULL, ev, TDB_LIT(state, REASON), TDB_LIT(state, BUDGET));
+    Tcl_DictObjPut(NULL, ev, TDB_LIT(state, ID), Tcl_NewIntObj(bp->id));
+    if (bp->sampleEvery > 1) {
+        bp->disabled = 1;
+        Tcl_DictObjPut(NULL, ev, TDB_LIT(state, ACTION), TDB_LIT(state, DISABLE));
+    } else {
+        /* Aim at half the budget so one more window is usually enough */
+        double every = 2.0 * pct / state->perfBudget;
+        bp->sampleEvery = every > 1048576.0 ? 1048576 : (int)every + 1;
+        if (bp->sampleEvery < 2) bp->sampleEvery = 2;
+        bp->sampleTick = 0;
+        Tcl_DictObjPut(NULL, ev, TDB_LIT(state, ACTION), TDB_LIT(state, SAMPLE));
+        Tcl_DictObjPut(NULL, ev, TDB_LIT(state, SAMPLEEVERY), Tcl_NewIntObj(bp->sampleEvery));
+    }
+    Tcl_DictObjPut(NULL, ev, TDB_LIT(state, OVERHEAD), Tcl_NewDoubleObj(pct));
+    Tcl_DictObjPut(NULL, ev, TDB_LIT(state, BUDGET), Tcl_NewDoubleObj(state->perfBudget));
+    state->degradedCount++;
+    TdbEventPush(state, TDB_EV_DEGRADED, ev);
+    Tcl_DecrRefCount(ev);
+}
+
+/* Charge time since `start` to bp and close the window when it is due.
+ * Returns the current time so callers can chain charges. */
+static Tcl_WideInt
+TdbBudgetCharge(TdbState *state, TdbBreakpoint *bp, Tcl_WideInt start)
+{
+    if (start == 0 || state->perfBudget <= 0) return 0;
+    Tcl_WideInt now = TdbNowNs();
+    if (bp) bp->costNs += now - start;
+    if (state->budgetWindowStart == 0) state->budgetWindowStart = start;
+    Tcl_WideInt elapsed = now - state->budgetWindowStart;
+    if (elapsed < (Tcl_WideInt)state->perfBudgetWindowMs * 1000000) return now;
+
+    Tcl_WideInt total = 0;
+    Tcl_HashSearch search;
+    Tcl_HashEntry *entry;
+    for (entry = Tcl_FirstHashEntry(&state->breakpoints, &search); entry; entry = Tcl_NextHashEntry(&search)) {
+        TdbBreakpoint *b = (TdbBreakpoint *)Tcl_GetHashValue(entry);
+        if (b->costNs == 0) continue;
+        total += b->costNs;
+        double pct = 100.0 * (double)b->costNs / (double)elapsed;
+        b->costNs = 0;
+        if (pct > state->perfBudget && !b->disabled) TdbBudgetDegrade(state, b, pct);
+    }
+    state->budgetLastPct = 100.0 * (double)total / (double)elapsed;
+    state->budgetWindowStart = now;
+    return now;
+}
+
+static TdbBreakpoint *
+TdbBreakpointById(TdbState *state, Tcl_Obj *idObj)
+{
+    int id = 0;
+    if (Tcl_GetIntFromObj(NULL, idObj, &id) != TCL_OK) return NULL;
+    Tcl_HashEntry *entry = Tcl_FindHashEntry(&state->breakpoints, (const char *)(intptr_t)id);
+    return entry ? (TdbBreakpoint *)Tcl_GetHashValue(entry) : NULL;
+}
+
+/* tdb::_bp_admit id ?start? -> "" when this hit is skipped (sampled out
+ * or disabled), else a start time for tdb::_charge (0 without a budget):
+ * start when it is given and nonzero, so the charge covers the work done
+ * before admission, otherwise now */
+static int
+TdbBpAdmitCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    (void)cd;
+    if (objc != 2 && objc != 3) {
+        Tcl_WrongNumArgs(interp, 1, objv, "id ?start?");
+        return TCL_ERROR;
+    }
+    TdbState *state = TdbGetState(interp);
+    TdbBreakpoint *bp = TdbBreakpointById(state, objv[1]);
+    Tcl_WideInt start = 0, since = 0;
+    if (objc == 3 && Tcl_GetWideIntFromObj(interp, objv[2], &since) != TCL_OK) return TCL_ERROR;
+    if (bp && !TdbBudgetAdmit(state, bp, &start)) {
+        Tcl_ResetResult(interp);
+        return TCL_OK;
+    }
+    if (start && since) start = since;
+    Tcl_SetObjResult(interp, start ? Tcl_NewWideIntObj(start) : TDB_LIT(state, ZERO));
+    return TCL_OK;
+}
+
+/* tdb::_now -> the budget clock, or 0 without a budget */
+static int
+TdbNowCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    (void)cd;
+    if (objc != 1) {
         Tcl_WrongNumArgs(interp, 1, objv, NULL);
-        Tcl_SetErrorCode(interp, "TDB", "START", "USAGE", NULL);
         return TCL_ERROR;
     }
     TdbState *state = TdbGetState(interp);
-    state->started = 1;
-    /* Reset counters on (re)start for predictable stats in tests */
-    state->traceHits = 0;
-    state->frameLookups = 0;
-    state->procFastRejects = 0;
-    state->fileFastRejects = 0;
-    Tdb_RecomputeTracing(interp);
-    Tcl_ResetResult(interp);
+    Tcl_SetObjResult(interp, state->perfBudget > 0 ? Tcl_NewWideIntObj(TdbNowNs()) : TDB_LIT(state, ZERO));
+    return TCL_OK;
+}
+
+/* tdb::_charge id start -> charge the time since start; returns now (or 0) */
+static int
+TdbChargeCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    (void)cd;
+    if (objc != 3) {
+        Tcl_WrongNumArgs(interp, 1, objv, "id start");
+        return TCL_ERROR;
+    }
+    TdbState *state = TdbGetState(interp);
+    Tcl_WideInt start = 0;
+    if (Tcl_GetWideIntFromObj(interp, objv[2], &start) != TCL_OK) return TCL_ERROR;
+    Tcl_WideInt now = TdbBudgetCharge(state, TdbBreakpointById(state, objv[1]), start);
+    Tcl_SetObjResult(interp, now ? Tcl_NewWideIntObj(now) : TDB_LIT(state, ZERO));
+    return TCL_OK;
+}
+
+/* ----------------------------------------------------------------------
+ * Latency breakpoints (-proc name -slowerThan duration)
+ *
+ * An enter/leave execution trace on the proc calls tdb::_lat with the
+ * breakpoint id. Entry pushes a monotonic timestamp; leave pops it, so a
+ * call under the threshold costs two clock reads. Slow calls are filtered
+ * like other breakpoints and then stop, log or are recorded. Timestamps
+ * nest per breakpoint, so a call that yields from a coroutine is timed
+ * until its own leave only if calls of that proc do not interleave.
+ *
+ * Tcl has no public per-command enter/leave hook in C, and replacing the
+ * proc's objProc or wrapping it in another command would break [info body]
+ * and yielding from it, so the trace stays a script-level one: each call
+ * of a traced proc costs Tcl's two trace callbacks (a few microseconds);
+ * other commands are unaffected.
+ *
+ * Redefining or deleting the proc drops its traces. A command delete trace
+ * notices that and queues the breakpoint in latencyPending, together with
+ * those whose proc did not exist yet; while any latency breakpoint exists a
+ * leave trace on ::proc retries the pending ones, as does every recompute.
+ * ---------------------------------------------------------------------- */
+
+/* "50ms", "2s", "250us", "1000ns"; a bare number is milliseconds */
+static int
+TdbParseDuration(Tcl_Interp *interp, Tcl_Obj *obj, Tcl_WideInt *nsPtr)
+{
+    const char *text = Tcl_GetString(obj);
+    char *end = NULL;
+    double v = strtod(text, &end);
+    double scale = 1e6;
+    if (end == text) goto bad;
+    if (*end == '\0' || strcmp(end, "ms") == 0) scale = 1e6;
+    else if (strcmp(end, "s") == 0) scale = 1e9;
+    else if (strcmp(end, "us") == 0) scale = 1e3;
+    else if (strcmp(end, "ns") == 0) scale = 1.0;
+    else goto bad;
+    if (!(v >= 0) || v * scale > 9.2e18) goto bad;
+    *nsPtr = (Tcl_WideInt)(v * scale);
+    return TCL_OK;
+bad:
+    return TdbError(interp, "BREAK", "VALUE", "duration must be a number with an optional ns, us, ms or s suffix");
+}
+
+static void
+TdbLatencyPend(TdbState *state, int id, int pending)
+{
+    int i;
+    for (i = 0; i < state->numLatencyPending && state->latencyPending[i] != id; i++) {}
+    if (!pending) {
+        if (i < state->numLatencyPending) state->latencyPending[i] = state->latencyPending[--state->numLatencyPending];
+        return;
+    }
+    if (i < state->numLatencyPending) return;
+    if (state->numLatencyPending == state->latencyPendingCap) {
+        state->latencyPendingCap = state->latencyPendingCap ? 2 * state->latencyPendingCap : 8;
+        state->latencyPending = (int *)ckrealloc((char *)state->latencyPending,
+                                                 state->latencyPendingCap * sizeof(int));
+    }
+    state->latencyPending[state->numLatencyPending++] = id;
+}
+
+/* [trace add|remove execution name {enter leave} {::tdb::_lat id}] */
+static int
+TdbLatencyExecTrace(TdbState *state, TdbBreakpoint *bp, Tcl_Obj *name, int install)
+{
+    Tcl_Interp *interp = state->interp;
+    Tcl_Obj *prefix[2], *words[6];
+    prefix[0] = Tcl_NewStringObj("::tdb::_lat", -1);
+    prefix[1] = Tcl_NewIntObj(bp->id);
+    words[0] = Tcl_NewStringObj("::trace", -1);
+    words[1] = Tcl_NewStringObj(install ? "add" : "remove", -1);
+    words[2] = Tcl_NewStringObj("execution", -1);
+    words[3] = name;
+    words[4] = Tcl_NewStringObj("enter leave", -1);
+    words[5] = Tcl_NewListObj(2, prefix);
+    Tcl_Obj *script = Tcl_NewListObj(6, words);
+    Tcl_IncrRefCount(script);
+    Tcl_InterpState saved = Tcl_SaveInterpState(interp, TCL_OK);
+    int rc = Tcl_EvalObjEx(interp, script, TCL_EVAL_GLOBAL);
+    Tcl_RestoreInterpState(interp, saved);
+    Tcl_DecrRefCount(script);
+    return rc;
+}
+
+/* The traced proc was deleted, redefined or renamed: its traces are gone
+ * (or now time another name), so wait for the name to come back */
+static void
+TdbLatencyCmdDeleted(ClientData cd, Tcl_Interp *interp, const char *oldName, const char *newName, int flags)
+{
+    TdbBreakpoint *bp = (TdbBreakpoint *)cd;
+    (void)oldName;
+    if (flags & TCL_INTERP_DESTROYED) return;
+    TdbState *state = TdbGetState(interp);
+    if (newName && *newName) {
+        Tcl_Obj *renamed = Tcl_NewStringObj(newName, -1);
+        Tcl_IncrRefCount(renamed);
+        TdbLatencyExecTrace(state, bp, renamed, 0);
+        Tcl_DecrRefCount(renamed);
+        Tcl_UntraceCommand(interp, newName, TCL_TRACE_RENAME|TCL_TRACE_DELETE, TdbLatencyCmdDeleted, bp);
+    }
+    bp->traced = 0;
+    TdbLatencyClearStarts(bp);
+    TdbLatencyPend(state, bp->id, 1);
+}
+
+/* Add or remove the enter/leave trace; keeps the interp result. A
+ * breakpoint whose proc does not exist stays pending. */
+static void
+TdbLatencyTrace(TdbState *state, TdbBreakpoint *bp, int install)
+{
+    Tcl_Interp *interp = state->interp;
+    if (Tcl_InterpDeleted(interp)) return;
+    TdbLatencyPend(state, bp->id, 0);
+    if (bp->traced) {
+        TdbLatencyExecTrace(state, bp, bp->procName, 0);
+        Tcl_UntraceCommand(interp, Tcl_GetString(bp->procName), TCL_TRACE_RENAME|TCL_TRACE_DELETE,
+                           TdbLatencyCmdDeleted, bp);
+        bp->traced = 0;
+    }
+    TdbLatencyClearStarts(bp);
+    if (!install) return;
+    if (TdbLatencyExecTrace(state, bp, bp->procName, 1) != TCL_OK) {
+        TdbLatencyPend(state, bp->id, 1);
+        return;
+    }
+    Tcl_TraceCommand(interp, Tcl_GetString(bp->procName), TCL_TRACE_RENAME|TCL_TRACE_DELETE,
+                     TdbLatencyCmdDeleted, bp);
+    bp->traced = 1;
+}
+
+/* Trace the procs of pending latency breakpoints that exist now */
+static void
+TdbLatencyRetry(TdbState *state)
+{
+    for (int i = state->numLatencyPending - 1; i >= 0; i--) {
+        if (i >= state->numLatencyPending) continue;
+        Tcl_HashEntry *entry = Tcl_FindHashEntry(&state->breakpoints,
+                                                 (const char *)(intptr_t)state->latencyPending[i]);
+        TdbBreakpoint *bp = entry ? (TdbBreakpoint *)Tcl_GetHashValue(entry) : NULL;
+        if (bp == NULL || bp->type != TDB_BP_LATENCY) {
+            TdbLatencyPend(state, state->latencyPending[i], 0);
+        } else {
+            Tcl_CmdInfo info;
+            if (Tcl_GetCommandInfo(state->interp, Tcl_GetString(bp->procName), &info)) TdbLatencyTrace(state, bp, 1);
+        }
+    }
+}
+
+/* Keep the ::proc leave trace installed while latency breakpoints exist */
+static void
+TdbLatencyProcHook(TdbState *state)
+{
+    int want = state->latencyBreakpointCount > 0;
+    if (want == state->procHooked || Tcl_InterpDeleted(state->interp)) return;
+    Tcl_InterpState saved = Tcl_SaveInterpState(state->interp, TCL_OK);
+    if (Tcl_EvalEx(state->interp, want ? "::trace add execution ::proc leave ::tdb::_latRetry"
+                                       : "::trace remove execution ::proc leave ::tdb::_latRetry",
+                   -1, TCL_EVAL_GLOBAL) == TCL_OK) {
+        state->procHooked = want;
+    }
+    Tcl_RestoreInterpState(state->interp, saved);
+}
+
+/* tdb::_latRetry args -- leave trace of ::proc */
+static int
+TdbLatencyRetryCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    (void)interp; (void)objc; (void)objv;
+    TdbState *state = (TdbState *)cd;
+    if (state->numLatencyPending > 0) TdbLatencyRetry(state);
+    return TCL_OK;
+}
+
+/* Filter and act on one slow call; returns 1 when a oneshot breakpoint
+ * fired and should be removed */
+static int
+TdbLatencyFire(TdbState *state, Tcl_Interp *interp, TdbBreakpoint *bp, Tcl_WideInt elapsed)
+{
+    if (bp->coroutinePattern) {
+        Tcl_Obj *coro = TdbCurrentCoroutine(interp);
+        Tcl_IncrRefCount(coro);
+        int match = Tcl_StringMatch(Tcl_GetString(coro), Tcl_GetString(bp->coroutinePattern));
+        Tcl_DecrRefCount(coro);
+        if (!match) return 0;
+    }
+    bp->hits += 1;
+    Tcl_WideInt t0;
+    if (!TdbBudgetAdmit(state, bp, &t0)) return 0;
+    /* The hook runs in the caller's frame, so conditions see its variables */
+    if (bp->condition) {
+        int condOK = 0;
+        if (Tcl_EvalObjEx(interp, bp->condition, 0) != TCL_OK ||
+            Tcl_GetBooleanFromObj(NULL, Tcl_GetObjResult(interp), &condOK) != TCL_OK) {
+            condOK = 0;
+        }
+        TdbBudgetCharge(state, bp, t0);
+        if (!condOK) return 0;
+    }
+    if (bp->hitCountSpec && !TdbHitSpecOk(Tcl_GetString(bp->hitCountSpec), bp->hits)) {
+        TdbBudgetCharge(state, bp, t0);
+        return 0;
+    }
+
+    /* The slow call site: the hook itself is evaluated without a frame */
+    Tcl_Obj *frame = TdbInfoFrame(state, interp, TDB_LIT(state, MINUS1));
+    Tcl_Obj *ev = frame ? Tcl_DuplicateObj(frame) : Tcl_NewDictObj();
+    if (frame) Tcl_DecrRefCount(frame);
+    Tcl_IncrRefCount(ev);
+    Tcl_DictObjPut(NULL, ev, TDB_LIT(state, ID), Tcl_NewIntObj(bp->id));
+    Tcl_DictObjPut(NULL, ev, TDB_LIT(state, PROC), bp->procName);
+    Tcl_DictObjPut(NULL, ev, TDB_LIT(state, ELAPSED), Tcl_NewDoubleObj((double)elapsed / 1e6));
+    Tcl_DictObjPut(NULL, ev, TDB_LIT(state, SLOWERTHAN), bp->slowerThan);
+    if (bp->action == TDB_LAT_RECORD) {
+        if (bp->records == NULL) {
+            bp->records = Tcl_NewListObj(0, NULL);
+            Tcl_IncrRefCount(bp->records);
+        } else if (Tcl_IsShared(bp->records)) {
+            Tcl_Obj *copy = Tcl_DuplicateObj(bp->records);
+            Tcl_IncrRefCount(copy);
+            Tcl_DecrRefCount(bp->records);
+            bp->records = copy;
+        }
+        int len = 0;
+        Tcl_ListObjLength(NULL, bp->records, &len);
+        if (len >= TDB_LATENCY_RECORDS) Tcl_ListObjReplace(NULL, bp->records, 0, len - TDB_LATENCY_RECORDS + 1, 0, NULL);
+        Tcl_ListObjAppendElement(NULL, bp->records, ev);
+    } else if (bp->action == TDB_LAT_LOG) {
+        Tcl_Obj *msg;
+        if (bp->logMessage) {
+            if (!bp->logSubstCmd) {
+                Tcl_Obj *words[4];
+                words[0] = TDB_LIT(state, SUBST);
+                words[1] = TDB_LIT(state, NOCOMMANDS);
+                words[2] = TDB_LIT(state, NOBACKSLASHES);
+                words[3] = bp->logMessage;
+                bp->logSubstCmd = Tcl_NewListObj(4, words);
+                Tcl_IncrRefCount(bp->logSubstCmd);
+            }
+            msg = (Tcl_EvalObjEx(interp, bp->logSubstCmd, 0) == TCL_OK) ? Tcl_GetObjResult(interp) : Tcl_NewObj();
+        } else {
+            char buf[64];
+            snprintf(buf, sizeof(buf), " took %.3f ms", (double)elapsed / 1e6);
+            msg = Tcl_DuplicateObj(bp->procName);
+            Tcl_AppendToObj(msg, buf, -1);
+        }
+        Tcl_IncrRefCount(msg);
+        Tcl_Obj *putsCmd[2];
+        putsCmd[0] = TDB_LIT(state, PUTS);
+        putsCmd[1] = msg;
+        (void)Tcl_EvalObjv(interp, 2, putsCmd, TCL_EVAL_GLOBAL|TCL_EVAL_DIRECT);
+        if (Tcl_IsShared(ev)) { Tcl_Obj *copy = Tcl_DuplicateObj(ev); Tcl_DecrRefCount(ev); ev = copy; Tcl_IncrRefCount(ev); }
+        Tcl_DictObjPut(NULL, ev, TDB_LIT(state, EVENT), TDB_LIT(state, LOG));
+        Tcl_DictObjPut(NULL, ev, TDB_LIT(state, REASON), TDB_LIT(state, SLOW));
+        Tcl_DictObjPut(NULL, ev, TDB_LIT(state, MESSAGE), msg);
+        Tcl_DecrRefCount(msg);
+        TdbEventPush(state, TDB_EV_LOG, ev);
+    } else {
+        Tcl_DictObjPut(NULL, ev, TDB_LIT(state, EVENT), TDB_LIT(state, STOPPED));
+        Tcl_DictObjPut(NULL, ev, TDB_LIT(state, REASON), TDB_LIT(state, SLOW));
+        Tdb_SetStopEvent(interp, ev, -1, TdbStopFrameAt(state, interp, TdbInfoInt(state, interp, TDB_LIT(state, LEVEL)), TdbInfoInt(state, interp, TDB_LIT(state, FRAME))));
+    }
+    Tcl_DecrRefCount(ev);
+    TdbBudgetCharge(state, bp, t0);
+    return bp->oneshot;
+}
+
+/* Key of the running call: coroutine and level. Calls suspended in one
+ * coroutine interleave with calls in others, so entry times cannot form
+ * one stack; within a coroutine a level holds one call at a time. The
+ * trace callback's result is discarded, so the evaluations here may
+ * overwrite it. */
+static void
+TdbLatencyKey(TdbState *state, Tcl_Interp *interp, Tcl_DString *key)
+{
+    char buf[32];
+    Tcl_Obj *argv0[2];
+    Tcl_DStringInit(key);
+    argv0[0] = TDB_LIT(state, QINFO);
+    argv0[1] = TDB_LIT(state, COROUTINE);
+    if (Tcl_EvalObjv(interp, 2, argv0, TCL_EVAL_DIRECT) == TCL_OK) {
+        Tcl_DStringAppend(key, Tcl_GetString(Tcl_GetObjResult(interp)), -1);
+    }
+    snprintf(buf, sizeof(buf), "\n%d", TdbInfoInt(state, interp, TDB_LIT(state, LEVEL)));
+    Tcl_DStringAppend(key, buf, -1);
+}
+
+/* tdb::_lat id command ?code result? enter|leave -- enter/leave execution
+ * trace callback of a latency breakpoint */
+static int
+TdbLatencyHookCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    TdbState *state = (TdbState *)cd;
+    if (objc < 4) {
+        Tcl_WrongNumArgs(interp, 1, objv, "id command ?code result? op");
+        return TCL_ERROR;
+    }
+    TdbBreakpoint *bp = TdbBreakpointById(state, objv[1]);
+    if (bp == NULL || bp->type != TDB_BP_LATENCY) return TCL_OK;
+    const char *op = Tcl_GetString(objv[objc-1]);
+    Tcl_DString key;
+    if (op[0] == 'e') {
+        if (!state->started) return TCL_OK;
+        int isNew = 0;
+        if (!bp->starts) {
+            bp->starts = (Tcl_HashTable *)ckalloc(sizeof(Tcl_HashTable));
+            Tcl_InitHashTable(bp->starts, TCL_STRING_KEYS);
+        }
+        TdbLatencyKey(state, interp, &key);
+        Tcl_HashEntry *entry = Tcl_CreateHashEntry(bp->starts, Tcl_DStringValue(&key), &isNew);
+        Tcl_DStringFree(&key);
+        /* A stale entry is a call whose coroutine was deleted while suspended */
+        if (isNew) Tcl_SetHashValue(entry, ckalloc(sizeof(Tcl_WideInt)));
+        *(Tcl_WideInt *)Tcl_GetHashValue(entry) = TdbNowNs();
+        return TCL_OK;
+    }
+    /* Calls entered before tdb::start (or before a reinstall) are not timed */
+    if (!bp->starts || bp->starts->numEntries == 0) return TCL_OK;
+    TdbLatencyKey(state, interp, &key);
+    Tcl_HashEntry *entry = Tcl_FindHashEntry(bp->starts, Tcl_DStringValue(&key));
+    Tcl_DStringFree(&key);
+    if (!entry) return TCL_OK;
+    Tcl_WideInt *start = (Tcl_WideInt *)Tcl_GetHashValue(entry);
+    Tcl_WideInt elapsed = TdbNowNs() - *start;
+    ckfree((char *)start);
+    Tcl_DeleteHashEntry(entry);
+    bp->calls++;
+    if (elapsed < bp->thresholdNs) return TCL_OK;
+    bp->slowCalls++;
+    if (elapsed > bp->maxNs) bp->maxNs = elapsed;
+    if (!state->started || state->isPaused) return TCL_OK;
+
+    Tcl_InterpState saved = Tcl_SaveInterpState(interp, TCL_OK);
+    int remove = TdbLatencyFire(state, interp, bp, elapsed);
+    Tcl_RestoreInterpState(interp, saved);
+    if (remove) {
+        TdbRemoveBreakpointEntry(state, Tcl_FindHashEntry(&state->breakpoints, (const char *)(intptr_t)bp->id));
+    }
+    return TCL_OK;
+}
+
+/* ----------------------------------------------------------------------
+ * Line coverage recording (tdb::coverage)
+ *
+ * Each file that coverage discovers is parsed once and every command in it
+ * (including nested bodies and [substitutions]) is indexed by a bounded key
+ * of its source text: the text itself, or for long commands such as proc
+ * and loop bodies its head, length and tail. Only the first execution of a
+ * line is recorded. A site whose places are all marked is done, so later
+ * executions cost one key probe. Until then each execution confirms its
+ * place with `info frame`: the same text may also live in a file sourced
+ * before coverage started, which is scanned when it first resolves and
+ * adds its own places. Unindexed text that keeps resolving to lines
+ * already marked (ensemble rewrites such as ::tcl::string::length 5, eval'd
+ * strings) stops being resolved once its first word did so
+ * TDB_COVERAGE_DYN_LIMIT times.
+ * ---------------------------------------------------------------------- */
+
+static void
+TdbCoverageSiteFree(TdbCoverageSite *site)
+{
+    if (site->locs) ckfree((char *)site->locs);
+    ckfree((char *)site);
+}
+
+static void
+TdbCoverageReset(TdbState *state)
+{
+    Tcl_HashSearch search;
+    Tcl_HashEntry *entry;
+    for (entry = Tcl_FirstHashEntry(&state->coverageSites, &search); entry; entry = Tcl_NextHashEntry(&search)) {
+        TdbCoverageSiteFree((TdbCoverageSite *)Tcl_GetHashValue(entry));
+    }
+    Tcl_DeleteHashTable(&state->coverageSites);
+    Tcl_InitHashTable(&state->coverageSites, TCL_STRING_KEYS);
+    Tcl_DeleteHashTable(&state->coverageDynWords);
+    Tcl_InitHashTable(&state->coverageDynWords, TCL_STRING_KEYS);
+    for (entry = Tcl_FirstHashEntry(&state->coverageFiles, &search); entry; entry = Tcl_NextHashEntry(&search)) {
+        TdbCoverageFile *cf = (TdbCoverageFile *)Tcl_GetHashValue(entry);
+        Tcl_DecrRefCount(cf->path);
+        if (cf->hit) ckfree(cf->hit);
+        if (cf->isCode) ckfree(cf->isCode);
+        ckfree(cf);
+    }
+    Tcl_DeleteHashTable(&state->coverageFiles);
+    Tcl_InitHashTable(&state->coverageFiles, TCL_STRING_KEYS);
+}
+
+/* Apply the -files pattern to one file record */
+static void
+TdbCoverageFilter(TdbState *state, TdbCoverageFile *cf)
+{
+    cf->excluded = state->coveragePattern &&
+        !Tcl_StringMatch(Tcl_GetString(cf->path), Tcl_GetString(state->coveragePattern));
+}
+
+/* Hash key for a command's text; distinct long commands that share a key
+ * become one site with several places */
+static void
+TdbCoverageKey(const char *text, int len, Tcl_DString *key)
+{
+    Tcl_DStringInit(key);
+    if (len <= TDB_COVERAGE_KEY_HEAD + TDB_COVERAGE_KEY_TAIL) {
+        Tcl_DStringAppend(key, text, len);
+        return;
+    }
+    char mid[32];
+    snprintf(mid, sizeof(mid), "\001%d\001", len);
+    Tcl_DStringAppend(key, text, TDB_COVERAGE_KEY_HEAD);
+    Tcl_DStringAppend(key, mid, -1);
+    Tcl_DStringAppend(key, text + len - TDB_COVERAGE_KEY_TAIL, TDB_COVERAGE_KEY_TAIL);
+}
+
+static void
+TdbCoverageAddLoc(TdbCoverageSite *site, TdbCoverageFile *cf, int line)
+{
+    for (int i = 0; i < site->numLocs; i++) {
+        if (site->locs[i].file == cf && site->locs[i].line == line) return;
+    }
+    site->locs = (TdbCoverageLoc *)ckrealloc((char *)site->locs, (site->numLocs + 1) * sizeof(TdbCoverageLoc));
+    site->locs[site->numLocs].file = cf;
+    site->locs[site->numLocs].line = line;
+    site->numLocs++;
+}
+
+static TdbCoverageSite *
+TdbCoverageNewSite(Tcl_HashEntry *entry)
+{
+    TdbCoverageSite *site = (TdbCoverageSite *)ckalloc(sizeof(TdbCoverageSite));
+    site->numLocs = 0;
+    site->done = 0;
+    site->locs = NULL;
+    Tcl_SetHashValue(entry, site);
+    return site;
+}
+
+/* Record one command of a scanned file in the text index */
+static void
+TdbCoverageIndex(TdbState *state, TdbCoverageFile *cf, const char *text, int len, int line)
+{
+    Tcl_DString key;
+    int isNew = 0;
+    TdbCoverageKey(text, len, &key);
+    Tcl_HashEntry *entry = Tcl_CreateHashEntry(&state->coverageSites, Tcl_DStringValue(&key), &isNew);
+    Tcl_DStringFree(&key);
+    TdbCoverageSite *site = isNew ? TdbCoverageNewSite(entry) : (TdbCoverageSite *)Tcl_GetHashValue(entry);
+    TdbCoverageAddLoc(site, cf, line);
+    site->done = 0;
+}
+
+static int
+TdbLinesBetween(const char *from, const char *to)
+{
+    int n = 0;
+    for (; from < to; from++) if (*from == '\n') n++;
+    return n;
+}
+
+/* Index the commands of a script starting at firstLine, recursing into
+ * braced words and command substitutions. Comments and blank lines are
+ * skipped by the parser, so they never count as code. */
+static void
+TdbCoverageScan(TdbState *state, TdbCoverageFile *cf, const char *script, int numBytes, int firstLine, int depth)
+{
+    const char *p = script, *end = script + numBytes, *lineAt = script;
+    int line = firstLine;
+    Tcl_Parse parse;
+    if (depth > 64) return;
+    while (p < end) {
+        if (Tcl_ParseCommand(NULL, p, (int)(end - p), 0, &parse) != TCL_OK) return;
+        if (parse.numWords > 0) {
+            line += TdbLinesBetween(lineAt, parse.commandStart);
+            lineAt = parse.commandStart;
+            int len = parse.commandSize;
+            if (parse.term == parse.commandStart + len - 1) len--;
+            if (line < cf->numLines) cf->isCode[line] = 1;
+            TdbCoverageIndex(state, cf, parse.commandStart, len, line);
+            for (int i = 0; i < parse.numTokens; i++) {
+                Tcl_Token *tok = &parse.tokenPtr[i];
+                int nested = (tok->type == TCL_TOKEN_COMMAND) ||
+                    (tok->type == TCL_TOKEN_SIMPLE_WORD && tok->start[0] == '{');
+                if (nested && tok->size > 2) {
+                    TdbCoverageScan(state, cf, tok->start + 1, tok->size - 2,
+                                    line + TdbLinesBetween(parse.commandStart, tok->start), depth + 1);
+                }
+            }
+        }
+        p = parse.commandStart + parse.commandSize;
+        Tcl_FreeParse(&parse);
+    }
+}
+
+/* Find or create the record for a normalized path, scanning it on creation */
+static TdbCoverageFile *
+TdbCoverageFileFor(TdbState *state, Tcl_Obj *pathObj)
+{
+    int isNew = 0;
+    Tcl_HashEntry *entry = Tcl_CreateHashEntry(&state->coverageFiles, Tcl_GetString(pathObj), &isNew);
+    if (!isNew) return (TdbCoverageFile *)Tcl_GetHashValue(entry);
+    TdbCoverageFile *cf = (TdbCoverageFile *)ckalloc(sizeof(TdbCoverageFile));
+    memset(cf, 0, sizeof(TdbCoverageFile));
+    cf->path = Tcl_DuplicateObj(pathObj);
+    Tcl_IncrRefCount(cf->path);
+    TdbCoverageFilter(state, cf);
+    Tcl_SetHashValue(entry, cf);
+    Tcl_Obj *text = TdbReadSourceText(cf->path);
+    if (text) {
+        int len = 0;
+        const char *src = Tcl_GetStringFromObj(text, &len);
+        cf->numLines = TdbLinesBetween(src, src + len) + 2;
+        cf->hit = (unsigned char *)ckalloc(cf->numLines);
+        memset(cf->hit, 0, cf->numLines);
+        cf->isCode = (unsigned char *)ckalloc(cf->numLines);
+        memset(cf->isCode, 0, cf->numLines);
+        TdbCoverageScan(state, cf, src, len, 1, 0);
+        Tcl_DecrRefCount(text);
+    }
+    return cf;
+}
+
+static TdbCoverageFile *
+TdbCoverageFileForPath(TdbState *state, Tcl_Obj *fileObj)
+{
+    Tcl_Obj *norm = Tcl_FSGetNormalizedPath(NULL, fileObj);
+    return TdbCoverageFileFor(state, norm ? norm : fileObj);
+}
+
+/* Where the traced command is, via [info frame 0]; file NULL when unknown */
+static void
+TdbCoverageResolve(TdbState *state, Tcl_Interp *ip, TdbCoverageFile **cfPtr, int *linePtr)
+{
+    Tcl_Obj *frame, *fileObj = NULL, *lineObj = NULL;
+    Tcl_InterpState saved = Tcl_SaveInterpState(ip, TCL_OK);
+    *cfPtr = NULL;
+    *linePtr = -1;
+    state->isPaused = 1;
+    frame = TdbInfoFrame(state, ip, TDB_LIT(state, ZERO));
+    if (frame) state->frameLookups++;
+    state->isPaused = 0;
+    Tcl_RestoreInterpState(ip, saved);
+    if (!frame) return;
+    if (Tcl_DictObjGet(NULL, frame, TDB_LIT(state, FILE), &fileObj) == TCL_OK && fileObj &&
+        Tcl_DictObjGet(NULL, frame, TDB_LIT(state, LINE), &lineObj) == TCL_OK && lineObj &&
+        Tcl_GetIntFromObj(NULL, lineObj, linePtr) == TCL_OK && *linePtr > 0) {
+        *cfPtr = TdbCoverageFileForPath(state, fileObj);
+    }
+    Tcl_DecrRefCount(frame);
+}
+
+static int
+TdbCoverageIsHit(const TdbCoverageLoc *loc)
+{
+    TdbCoverageFile *cf = loc->file;
+    return cf->excluded || (loc->line < cf->numLines && cf->hit[loc->line]);
+}
+
+static void
+TdbCoverageHit(TdbCoverageFile *cf, int line)
+{
+    if (!cf || line <= 0 || cf->excluded) return;
+    if (line >= cf->numLines) {
+        int n = cf->numLines ? cf->numLines : 64;
+        while (n <= line) n *= 2;
+        cf->hit = (unsigned char *)ckrealloc((char *)cf->hit, n);
+        memset(cf->hit + cf->numLines, 0, n - cf->numLines);
+        cf->isCode = (unsigned char *)ckrealloc((char *)cf->isCode, n);
+        memset(cf->isCode + cf->numLines, 0, n - cf->numLines);
+        cf->numLines = n;
+    }
+    cf->hit[line] = 1;
+}
+
+static void
+TdbCoverageMark(TdbState *state, Tcl_Interp *ip, const char *cmdStr, int objc, Tcl_Obj *const objv[])
+{
+    TdbCoverageFile *cf = NULL;
+    TdbCoverageSite *site = NULL;
+    Tcl_DString key;
+    int line = -1;
+    if (!cmdStr) return;
+    /* Index a file before [source] runs it, so its first commands resolve too */
+    if (objc >= 2) {
+        const char *name = Tcl_GetString(objv[0]);
+        if (strcmp(name, "source") == 0 || strcmp(name, "::source") == 0) {
+            (void)TdbCoverageFileForPath(state, objv[objc-1]);
+        }
+    }
+    int len = (int)strlen(cmdStr);
+    Tcl_HashEntry *entry;
+    if (len <= TDB_COVERAGE_KEY_HEAD + TDB_COVERAGE_KEY_TAIL) {
+        /* Short text is its own key: a marked site costs one probe, no copy */
+        entry = Tcl_FindHashEntry(&state->coverageSites, cmdStr);
+        if (entry && ((TdbCoverageSite *)Tcl_GetHashValue(entry))->done) return;
+    }
+    TdbCoverageKey(cmdStr, len, &key);
+    entry = Tcl_FindHashEntry(&state->coverageSites, Tcl_DStringValue(&key));
+    if (entry) site = (TdbCoverageSite *)Tcl_GetHashValue(entry);
+    if (site && site->done) goto done;
+    Tcl_HashEntry *wordEntry = NULL;
+    if (!site && objc > 0) {
+        wordEntry = Tcl_FindHashEntry(&state->coverageDynWords, Tcl_GetString(objv[0]));
+        if (wordEntry && (int)(intptr_t)Tcl_GetHashValue(wordEntry) >= TDB_COVERAGE_DYN_LIMIT) goto done;
+    }
+    TdbCoverageResolve(state, ip, &cf, &line);
+    if (!site) {
+        /* Resolving may have indexed a newly discovered file */
+        entry = Tcl_FindHashEntry(&state->coverageSites, Tcl_DStringValue(&key));
+        if (entry) site = (TdbCoverageSite *)Tcl_GetHashValue(entry);
+    }
+    if (!site) {
+        int fresh = cf && line > 0 && !cf->excluded && !(line < cf->numLines && cf->hit[line]);
+        TdbCoverageHit(cf, line);
+        if (fresh && state->coverageSites.numEntries < TDB_COVERAGE_MAX_SITES) {
+            /* Dynamic code: remember the one place it was seen at */
+            int isNew = 0;
+            entry = Tcl_CreateHashEntry(&state->coverageSites, Tcl_DStringValue(&key), &isNew);
+            site = TdbCoverageNewSite(entry);
+            TdbCoverageAddLoc(site, cf, line);
+            site->done = 1;
+        } else if (!fresh && objc > 0) {
+            int isNew = 0, runs = 0;
+            if (!wordEntry) wordEntry = Tcl_CreateHashEntry(&state->coverageDynWords, Tcl_GetString(objv[0]), &isNew);
+            if (!isNew) runs = (int)(intptr_t)Tcl_GetHashValue(wordEntry);
+            Tcl_SetHashValue(wordEntry, (ClientData)(intptr_t)(runs + 1));
+        }
+        goto done;
+    }
+    TdbCoverageHit(cf, line);
+    site->done = 1;
+    for (int i = 0; i < site->numLocs; i++) {
+        if (!TdbCoverageIsHit(&site->locs[i])) { site->done = 0; break; }
+    }
+done:
+    Tcl_DStringFree(&key);
+}
+
+/* ----------------------------------------------------------------------
+ * Object trace installation (Prompt 4B)
+ *
+ * The callback is chosen from the kinds of work that need it when tracing
+ * is recomputed, so each configuration runs only its own checks: coverage
+ * alone, method breakpoints alone, or file:line breakpoints alone. Other
+ * combinations use the general callback. File:line breakpoints probe the
+ * first word of each command against the words that start their lines, so
+ * only candidates pay for [info frame]. Proc breakpoints and stepping run
+ * on Tcl exec traces (proc breakpoints pause in the proc's own frame,
+ * after its arguments are bound), so they never need the object trace and
+ * proc-only configurations install none.
+ * ---------------------------------------------------------------------- */
+
+typedef enum {
+    TDB_TRACE_NONE = 0,
+    TDB_TRACE_COVERAGE = 1,
+    TDB_TRACE_METHOD = 2,
+    TDB_TRACE_FILE = 4
+} TdbTraceKind;
+
+/* Full name of the traced command, in the state's scratch object (valid
+ * until the next trace callback), or objv[0] */
+static Tcl_Obj *
+TdbTraceCommandName(TdbState *state, Tcl_Interp *ip, Tcl_Command cmdTok, int objc, Tcl_Obj *const objv[])
+{
+    if (cmdTok != NULL) {
+        Tcl_SetObjLength(state->traceName, 0);
+        Tcl_GetCommandFullName(ip, cmdTok, state->traceName);
+        return state->traceName;
+    }
+    return (objc > 0) ? objv[0] : NULL;
+}
+
+/* First word of the first command starting on each line of a file:
+ * words[line] is NULL where no command starts and an empty object where
+ * the word is substituted */
+typedef struct {
+    int numLines;
+    Tcl_Obj **words;
+} TdbLineWords;
+
+/* Fill the line words of a script starting at firstLine, recursing like
+ * TdbCoverageScan; outer commands are seen before the ones they contain */
+static void
+TdbLineWordsScan(TdbLineWords *lw, const char *script, int numBytes, int firstLine, int depth)
+{
+    const char *p = script, *end = script + numBytes, *lineAt = script;
+    int line = firstLine;
+    Tcl_Parse parse;
+    if (depth > 64) return;
+    while (p < end) {
+        if (Tcl_ParseCommand(NULL, p, (int)(end - p), 0, &parse) != TCL_OK) return;
+        if (parse.numWords > 0) {
+            line += TdbLinesBetween(lineAt, parse.commandStart);
+            lineAt = parse.commandStart;
+            Tcl_Token *word = &parse.tokenPtr[0];
+            if (line < lw->numLines && !lw->words[line]) {
+                lw->words[line] = (word->type == TCL_TOKEN_SIMPLE_WORD)
+                    ? Tcl_NewStringObj(word[1].start, word[1].size) : Tcl_NewObj();
+                Tcl_IncrRefCount(lw->words[line]);
+            }
+            for (int i = 0; i < parse.numTokens; i++) {
+                Tcl_Token *tok = &parse.tokenPtr[i];
+                int nested = (tok->type == TCL_TOKEN_COMMAND) ||
+                    (tok->type == TCL_TOKEN_SIMPLE_WORD && tok->start[0] == '{');
+                if (nested && tok->size > 2) {
+                    TdbLineWordsScan(lw, tok->start + 1, tok->size - 2,
+                                     line + TdbLinesBetween(parse.commandStart, tok->start), depth + 1);
+                }
+            }
+        }
+        p = parse.commandStart + parse.commandSize;
+        Tcl_FreeParse(&parse);
+    }
+}
+
+/* Line words of a source file; an unreadable file has no lines */
+static TdbLineWords *
+TdbLineWordsRead(Tcl_Obj *pathObj)
+{
+    TdbLineWords *lw = (TdbLineWords *)ckalloc(sizeof(TdbLineWords));
+    lw->numLines = 0;
+    lw->words = NULL;
+    Tcl_Obj *text = TdbReadSourceText(pathObj);
+    if (text) {
+        int len = 0;
+        const char *src = Tcl_GetStringFromObj(text, &len);
+        lw->numLines = TdbLinesBetween(src, src + len) + 2;
+        lw->words = (Tcl_Obj **)ckalloc(lw->numLines * sizeof(Tcl_Obj *));
+        memset(lw->words, 0, lw->numLines * sizeof(Tcl_Obj *));
+        TdbLineWordsScan(lw, src, len, 1, 0);
+        Tcl_DecrRefCount(text);
+    }
+    return lw;
+}
+
+static void
+TdbLineWordsFree(TdbLineWords *lw)
+{
+    for (int i = 0; i < lw->numLines; i++) {
+        if (lw->words[i]) Tcl_DecrRefCount(lw->words[i]);
+    }
+    if (lw->words) ckfree((char *)lw->words);
+    ckfree((char *)lw);
+}
+
+/* Forget the parsed files of file breakpoints */
+static void
+TdbFileLineWordsClear(TdbState *state)
+{
+    Tcl_HashSearch search;
+    for (Tcl_HashEntry *fe = Tcl_FirstHashEntry(&state->fileLineWords, &search); fe; fe = Tcl_NextHashEntry(&search)) {
+        TdbLineWordsFree((TdbLineWords *)Tcl_GetHashValue(fe));
+    }
+    Tcl_DeleteHashTable(&state->fileLineWords);
+    Tcl_InitHashTable(&state->fileLineWords, TCL_STRING_KEYS);
+}
+
+/* Line a file breakpoint stops on: its own line when a command starts
+ * there, else the nearest command start within TDB_LINE_DRIFT lines (the
+ * later one on a tie); 0 when there is none */
+static int
+TdbFileBreakLine(TdbLineWords *lw, int line)
+{
+    for (int d = 0; d <= TDB_LINE_DRIFT; d++) {
+        if (line + d > 0 && line + d < lw->numLines && lw->words[line + d]) return line + d;
+        if (line - d > 0 && line - d < lw->numLines && lw->words[line - d]) return line - d;
+    }
+    return 0;
+}
+
+/* Rebuild the word set probed by TdbTraceFileLine from the command each
+ * file breakpoint stops on. A file is parsed the first time one of its
+ * breakpoints is indexed and kept until it is sourced again (see
+ * TdbFileLineSourced) or loses its last breakpoint. [source] itself is
+ * always a candidate. */
+static void
+TdbIndexFileBreakpoints(TdbState *state)
+{
+    Tcl_HashTable used;  /* normalized paths that still have breakpoints */
+    Tcl_HashSearch search;
+    int isNew;
+    Tcl_DeleteHashTable(&state->fileBpWords);
+    Tcl_InitHashTable(&state->fileBpWords, TCL_STRING_KEYS);
+    state->fileBpAnyWord = 0;
+    if (!state->started || !state->haveFileLineBps) {
+        TdbFileLineWordsClear(state);
+        return;
+    }
+    /* A non-NULL value marks [source] when no breakpoint line starts with it */
+    Tcl_SetHashValue(Tcl_CreateHashEntry(&state->fileBpWords, "source", &isNew), (ClientData)1);
+    Tcl_SetHashValue(Tcl_CreateHashEntry(&state->fileBpWords, "::source", &isNew), (ClientData)1);
+    Tcl_InitHashTable(&used, TCL_STRING_KEYS);
+    for (Tcl_HashEntry *entry = Tcl_FirstHashEntry(&state->breakpoints, &search); entry; entry = Tcl_NextHashEntry(&search)) {
+        TdbBreakpoint *bp = (TdbBreakpoint *)Tcl_GetHashValue(entry);
+        if (bp->type != TDB_BP_FILE || !bp->filePath) continue;
+        bp->stopLine = 0;
+        Tcl_Obj *norm = Tcl_FSGetNormalizedPath(NULL, bp->filePath);
+        if (!norm) continue;
+        Tcl_CreateHashEntry(&used, Tcl_GetString(norm), &isNew);
+        Tcl_HashEntry *fe = Tcl_CreateHashEntry(&state->fileLineWords, Tcl_GetString(norm), &isNew);
+        if (isNew) Tcl_SetHashValue(fe, TdbLineWordsRead(norm));
+        TdbLineWords *lw = (TdbLineWords *)Tcl_GetHashValue(fe);
+        bp->stopLine = TdbFileBreakLine(lw, bp->line);
+        if (bp->stopLine == 0) continue;
+        Tcl_Obj *word = lw->words[bp->stopLine];
+        if (Tcl_GetCharLength(word) == 0) {
+            state->fileBpAnyWord = 1;
+        } else {
+            Tcl_SetHashValue(Tcl_CreateHashEntry(&state->fileBpWords, Tcl_GetString(word), &isNew), NULL);
+        }
+    }
+    for (Tcl_HashEntry *fe = Tcl_FirstHashEntry(&state->fileLineWords, &search); fe; fe = Tcl_NextHashEntry(&search)) {
+        if (Tcl_FindHashEntry(&used, Tcl_GetHashKey(&state->fileLineWords, fe))) continue;
+        TdbLineWordsFree((TdbLineWords *)Tcl_GetHashValue(fe));
+        Tcl_DeleteHashEntry(fe);
+    }
+    Tcl_DeleteHashTable(&used);
+}
+
+/* [source] of a file with breakpoints: parse it again before it is
+ * evaluated, so its breakpoints follow edits and files created after the
+ * breakpoints were added */
+static void
+TdbFileLineSourced(TdbState *state, int objc, Tcl_Obj *const objv[])
+{
+    if (objc < 2) return;
+    Tcl_Obj *norm = Tcl_FSGetNormalizedPath(NULL, objv[objc - 1]);
+    if (!norm) return;
+    Tcl_HashEntry *fe = Tcl_FindHashEntry(&state->fileLineWords, Tcl_GetString(norm));
+    if (!fe) return;
+    TdbLineWordsFree((TdbLineWords *)Tcl_GetHashValue(fe));
+    Tcl_DeleteHashEntry(fe);
+    TdbIndexFileBreakpoints(state);
+}
+
+/* File:line breakpoints: one probe of objv[0] against the first words of
+ * the breakpoint lines, and [info frame] only for candidates. A command in
+ * a proc body on the line a breakpoint of its file stops on is handed to
+ * ::tdb::_apply_fileline_breaks in the command's frame, with the ids of
+ * those breakpoints and the time the hit started (for -perf.budget); it
+ * handles conditions, hit counts, logpoints and the stop event. */
+static void
+TdbTraceFileLine(TdbState *state, Tcl_Interp *ip, int objc, Tcl_Obj *const objv[])
+{
+    const char *word = (objc < 1) ? "" : Tcl_GetString(objv[0]);
+    Tcl_HashEntry *wordEntry = Tcl_FindHashEntry(&state->fileBpWords, word);
+    if (!state->fileBpAnyWord && wordEntry == NULL) {
+        state->fileFastRejects++;
+        return;
+    }
+    if (wordEntry != NULL && (strcmp(word, "source") == 0 || strcmp(word, "::source") == 0)) {
+        TdbFileLineSourced(state, objc, objv);
+        /* The rebuild replaced the entry */
+        wordEntry = Tcl_FindHashEntry(&state->fileBpWords, word);
+        if (!state->fileBpAnyWord && Tcl_GetHashValue(wordEntry) != NULL) return;
+    }
+    Tcl_WideInt start = state->perfBudget > 0 ? TdbNowNs() : 0;
+    Tcl_InterpState saved = Tcl_SaveInterpState(ip, TCL_OK);
+    Tcl_Obj *fileObj = NULL, *lineObj = NULL, *procObj = NULL, *norm = NULL, *ids = NULL;
+    int line = 0, absLevel = 0;
+    state->isPaused = 1;
+    Tcl_Obj *frame = TdbInfoFrame(state, ip, TDB_LIT(state, ZERO));
+    if (frame) state->frameLookups++;
+    if (frame &&
+        Tcl_DictObjGet(NULL, frame, TDB_LIT(state, PROC), &procObj) == TCL_OK && procObj &&
+        Tcl_DictObjGet(NULL, frame, TDB_LIT(state, FILE), &fileObj) == TCL_OK && fileObj &&
+        Tcl_DictObjGet(NULL, frame, TDB_LIT(state, LINE), &lineObj) == TCL_OK && lineObj &&
+        Tcl_GetIntFromObj(NULL, lineObj, &line) == TCL_OK &&
+        (norm = Tcl_FSGetNormalizedPath(NULL, fileObj)) != NULL) {
+        Tcl_IncrRefCount(norm);
+        Tcl_HashSearch search;
+        for (Tcl_HashEntry *entry = Tcl_FirstHashEntry(&state->breakpoints, &search); entry; entry = Tcl_NextHashEntry(&search)) {
+            TdbBreakpoint *bp = (TdbBreakpoint *)Tcl_GetHashValue(entry);
+            if (bp->type != TDB_BP_FILE || !bp->filePath || bp->stopLine != line) continue;
+            Tcl_Obj *bpNorm = Tcl_FSGetNormalizedPath(NULL, bp->filePath);
+            if (bpNorm && strcmp(Tcl_GetString(bpNorm), Tcl_GetString(norm)) == 0) {
+                if (!ids) ids = Tcl_NewListObj(0, NULL);
+                Tcl_ListObjAppendElement(NULL, ids, Tcl_NewIntObj(bp->id));
+            }
+        }
+    }
+    if (ids) {
+        /* [info frame] level is relative; conditions need #N from [info level] */
+        Tcl_Obj *lv[2];
+        lv[0] = TDB_LIT(state, INFO);
+        lv[1] = TDB_LIT(state, LEVEL);
+        if (Tcl_EvalObjv(ip, 2, lv, 0) == TCL_OK) Tcl_GetIntFromObj(NULL, Tcl_GetObjResult(ip), &absLevel);
+        Tcl_Obj *fr = Tcl_DuplicateObj(frame);
+        Tcl_DictObjPut(NULL, fr, TDB_LIT(state, LEVEL), Tcl_NewIntObj(absLevel));
+        Tcl_Obj *words[6];
+        words[0] = Tcl_NewStringObj("::tdb::_apply_fileline_breaks", -1);
+        words[1] = fr;
+        words[2] = norm;
+        words[3] = lineObj;
+        words[4] = ids;
+        words[5] = start ? Tcl_NewWideIntObj(start) : TDB_LIT(state, ZERO);
+        for (int i = 0; i < 6; i++) Tcl_IncrRefCount(words[i]);
+        /* Not global, so uplevel #N in the shim reaches the command's frame */
+        state->inFileLineHook++;
+        (void)Tcl_EvalObjv(ip, 6, words, 0);
+        state->inFileLineHook--;
+        for (int i = 0; i < 6; i++) Tcl_DecrRefCount(words[i]);
+    }
+    state->isPaused = 0;
+    if (norm) Tcl_DecrRefCount(norm);
+    if (frame) Tcl_DecrRefCount(frame);
+    Tcl_RestoreInterpState(ip, saved);
+}
+
+/* Evaluate method breakpoints for "obj subcmd ..."; conditions, hit counts
+ * and logpoints run in the caller's frame with $cmd set to the words. A
+ * pause publishes a stop event; oneshot breakpoints that fired are
+ * removed. With withProc the event also carries the command's full name
+ * as proc. */
+static void
+TdbTraceMethod(TdbState *state, Tcl_Interp *ip, Tcl_Command cmdTok, int objc, Tcl_Obj *const objv[], int withProc)
+{
+    if (objc < 2 || !objv[0] || !objv[1]) return;
+    const char *objName = Tcl_GetString(objv[0]);
+    const char *subcmd = Tcl_GetString(objv[1]);
+    int pause = 0;
+    int rmId = 0;
+    int haveFrame = 0;
+    TdbBreakpoint *pauseBp = NULL;
+    Tcl_WideInt pauseT0 = 0;
+    int absLevel = 0;
+    Tcl_Obj *frameDict = NULL;
+    Tcl_Obj *levelObj = NULL;
+    Tcl_Obj *coroObj = NULL;
+    Tcl_HashSearch search;
+    for (Tcl_HashEntry *entry = Tcl_FirstHashEntry(&state->breakpoints, &search); entry; entry = Tcl_NextHashEntry(&search)) {
+        TdbBreakpoint *bp = (TdbBreakpoint *)Tcl_GetHashValue(entry);
+        if (bp->type != TDB_BP_METHOD || !bp->methodPattern || !bp->methodName) continue;
+        if (strcmp(subcmd, Tcl_GetString(bp->methodName)) != 0 ||
+            !Tcl_StringMatch(objName, Tcl_GetString(bp->methodPattern))) continue;
+        /* Coroutine filter runs before hits and conditions */
+        if (bp->coroutinePattern) {
+            if (!coroObj) { coroObj = TdbCurrentCoroutine(ip); Tcl_IncrRefCount(coroObj); }
+            if (!Tcl_StringMatch(Tcl_GetString(coroObj), Tcl_GetString(bp->coroutinePattern))) continue;
+        }
+        bp->hits += 1;
+        Tcl_WideInt t0;
+        if (!TdbBudgetAdmit(state, bp, &t0)) continue;
+        if (!haveFrame) {
+            state->isPaused = 1;
+            frameDict = TdbInfoFrame(state, ip, TDB_LIT(state, MINUS1));
+            if (frameDict) state->frameLookups++;
+            state->isPaused = 0;
+            haveFrame = 1;
+            if (frameDict) {
+                Tcl_Obj *lvl = NULL;
+                if (Tcl_DictObjGet(NULL, frameDict, TDB_LIT(state, LEVEL), &lvl) == TCL_OK && lvl) {
+                    Tcl_GetIntFromObj(NULL, lvl, &absLevel);
+                }
+            }
+            levelObj = TdbLevelObj(state, absLevel);
+            Tcl_IncrRefCount(levelObj);
+            /* Provide $cmd list to the condition frame: uplevel #N {set cmd $cmdList} */
+            Tcl_Obj *setWords[3];
+            setWords[0] = TDB_LIT(state, SET);
+            setWords[1] = TDB_LIT(state, CMD);
+            setWords[2] = Tcl_NewListObj(objc, objv);
+            Tcl_Obj *setCmdScript[3];
+            setCmdScript[0] = TDB_LIT(state, UPLEVEL);
+            setCmdScript[1] = levelObj;
+            setCmdScript[2] = Tcl_NewListObj(3, setWords);
+            Tcl_IncrRefCount(setCmdScript[2]);
+            (void)Tcl_EvalObjv(ip, 3, setCmdScript, TCL_EVAL_GLOBAL|TCL_EVAL_DIRECT);
+            Tcl_DecrRefCount(setCmdScript[2]);
+        }
+
+        /* Condition: a script whose result must be boolean true */
+        if (bp->condition) {
+            int condOK = 0;
+            Tcl_Obj *ul[3];
+            ul[0] = TDB_LIT(state, UPLEVEL);
+            ul[1] = levelObj;
+            ul[2] = bp->condition;
+            if (Tcl_EvalObjv(ip, 3, ul, TCL_EVAL_GLOBAL|TCL_EVAL_DIRECT) != TCL_OK ||
+                Tcl_GetBooleanFromObj(NULL, Tcl_GetObjResult(ip), &condOK) != TCL_OK) {
+                condOK = 0;
+            }
+            t0 = TdbBudgetCharge(state, bp, t0);
+            if (!condOK) continue;
+        }
+        if (bp->hitCountSpec && !TdbHitSpecOk(Tcl_GetString(bp->hitCountSpec), bp->hits)) {
+            TdbBudgetCharge(state, bp, t0);
+            continue;
+        }
+        /* Log-only */
+        if (bp->logMessage) {
+            /* uplevel #N {subst -nocommands -nobackslashes $tmpl}; the subst
+             * vector is built once per breakpoint */
+            if (!bp->logSubstCmd) {
+                Tcl_Obj *words[4];
+                words[0] = TDB_LIT(state, SUBST);
+                words[1] = TDB_LIT(state, NOCOMMANDS);
+                words[2] = TDB_LIT(state, NOBACKSLASHES);
+                words[3] = bp->logMessage;
+                bp->logSubstCmd = Tcl_NewListObj(4, words);
+                Tcl_IncrRefCount(bp->logSubstCmd);
+            }
+            Tcl_Obj *ul2[3];
+            ul2[0] = TDB_LIT(state, UPLEVEL);
+            ul2[1] = levelObj;
+            ul2[2] = bp->logSubstCmd;
+            if (Tcl_EvalObjv(ip, 3, ul2, TCL_EVAL_GLOBAL|TCL_EVAL_DIRECT) == TCL_OK) {
+                Tcl_Obj *msg = Tcl_GetObjResult(ip);
+                Tcl_IncrRefCount(msg);
+                Tcl_Obj *putsCmd[2];
+                putsCmd[0] = TDB_LIT(state, PUTS);
+                putsCmd[1] = msg;
+                (void)Tcl_EvalObjv(ip, 2, putsCmd, TCL_EVAL_GLOBAL|TCL_EVAL_DIRECT);
+                /* Queue a non-pausing log event */
+                Tcl_Obj *logEv = frameDict ? Tcl_DuplicateObj(frameDict) : Tcl_NewDictObj();
+                Tcl_IncrRefCount(logEv);
+                Tcl_DictObjPut(NULL, logEv, TDB_LIT(state, EVENT), TDB_LIT(state, LOG));
+                Tcl_DictObjPut(NULL, logEv, TDB_LIT(state, REASON), TDB_LIT(state, LOGPOINT));
+                Tcl_DictObjPut(NULL, logEv, TDB_LIT(state, ID), Tcl_NewIntObj(bp->id));
+                Tcl_DictObjPut(NULL, logEv, TDB_LIT(state, MESSAGE), msg);
+                TdbEventPush(state, TDB_EV_LOG, logEv);
+                Tcl_DecrRefCount(logEv);
+                Tcl_DecrRefCount(msg);
+            }
+            TdbBudgetCharge(state, bp, t0);
+            if (bp->oneshot) rmId = bp->id;
+            continue;
+        }
+        pause = 1;
+        pauseBp = bp;
+        pauseT0 = t0;
+        if (bp->oneshot) rmId = bp->id;
+        break;
+    }
+    if (coroObj) Tcl_DecrRefCount(coroObj);
+    if (levelObj) Tcl_DecrRefCount(levelObj);
+
+    if (pause) {
+        Tcl_Obj *event = frameDict ? Tcl_DuplicateObj(frameDict) : Tcl_NewDictObj();
+        Tcl_IncrRefCount(event);
+        Tcl_DictObjPut(NULL, event, TDB_LIT(state, EVENT), TDB_LIT(state, STOPPED));
+        Tcl_DictObjPut(NULL, event, TDB_LIT(state, REASON), TDB_LIT(state, BREAKPOINT));
+        if (withProc) {
+            Tcl_Obj *name = TdbTraceCommandName(state, ip, cmdTok, objc, objv);
+            if (name) Tcl_DictObjPut(NULL, event, TDB_LIT(state, PROC), Tcl_DuplicateObj(name));
+        }
+        Tdb_SetStopEvent(ip, event, -1, TdbStopFrameAt(state, ip, TdbInfoInt(state, ip, TDB_LIT(state, LEVEL)), TdbInfoInt(state, ip, TDB_LIT(state, FRAME))));
+        Tcl_DecrRefCount(event);
+        TdbBudgetCharge(state, pauseBp, pauseT0);
+    }
+    if (frameDict) Tcl_DecrRefCount(frameDict);
+    if (rmId > 0) {
+        TdbRemoveBreakpointEntry(state, Tcl_FindHashEntry(&state->breakpoints, (const char *)(intptr_t)rmId));
+        Tdb_RecomputeTracing(ip);
+    }
+}
+
+/* Coverage recording only (tdb::coverage without breakpoints) */
+static int
+TdbTraceCoverageProc(ClientData cd, Tcl_Interp *ip, int level, const char *cmdStr,
+                     Tcl_Command cmdTok, int objc, Tcl_Obj *const objv[])
+{
+    (void)level; (void)cmdTok;
+    TdbState *state = (TdbState *)cd;
+    state->traceHits++;
+    if (!state->isPaused) TdbCoverageMark(state, ip, cmdStr, objc, objv);
+    return TCL_OK;
+}
+
+/* Method breakpoints only */
+static int
+TdbTraceMethodOnlyProc(ClientData cd, Tcl_Interp *ip, int level, const char *cmdStr,
+                       Tcl_Command cmdTok, int objc, Tcl_Obj *const objv[])
+{
+    (void)level; (void)cmdStr;
+    TdbState *state = (TdbState *)cd;
+    state->traceHits++;
+    if (state->isPaused) return TCL_OK;
+    TdbTraceMethod(state, ip, cmdTok, objc, objv, state->haveProcBps);
+    return TCL_OK;
+}
+
+/* File:line breakpoints only */
+static int
+TdbTraceFileOnlyProc(ClientData cd, Tcl_Interp *ip, int level, const char *cmdStr,
+                     Tcl_Command cmdTok, int objc, Tcl_Obj *const objv[])
+{
+    (void)level; (void)cmdStr; (void)cmdTok;
+    TdbState *state = (TdbState *)cd;
+    state->traceHits++;
+    if (state->isPaused) return TCL_OK;
+    TdbTraceFileLine(state, ip, objc, objv);
+    return TCL_OK;
+}
+
+/* General callback: any other combination of kinds; checks every flag */
+static int
+Tdb_ObjTraceProc(ClientData cd, Tcl_Interp *ip, int level, const char *cmdStr,
+                 Tcl_Command cmdTok, int objc, Tcl_Obj *const objv[])
+{
+    (void)level;
+    TdbState *state = (TdbState *)cd;
+    state->traceHits++;
+    if (state->isPaused) return TCL_OK;
+    if (state->coverageActive) {
+        TdbCoverageMark(state, ip, cmdStr, objc, objv);
+        if (!state->started) return TCL_OK;
+    }
+    if (state->methodBreakpointCount > 0) TdbTraceMethod(state, ip, cmdTok, objc, objv, state->haveProcBps);
+    if (state->haveFileLineBps) TdbTraceFileLine(state, ip, objc, objv);
+    return TCL_OK;
+}
+
+static const char *const tdbTraceKindNames[] = {
+    "none", "coverage", "method", "coverage+method",
+    "file", "coverage+file", "method+file", "coverage+method+file"
+};
+
+static Tcl_CmdObjTraceProc *
+TdbTraceProcForKind(int kind)
+{
+    switch (kind) {
+    case TDB_TRACE_COVERAGE: return TdbTraceCoverageProc;
+    case TDB_TRACE_METHOD: return TdbTraceMethodOnlyProc;
+    case TDB_TRACE_FILE: return TdbTraceFileOnlyProc;
+    default: return Tdb_ObjTraceProc;
+    }
+}
+
+static void
+Tdb_RemoveObjTrace(Tcl_Interp *interp)
+{
+    TdbState *state = TdbGetState(interp);
+    if (state->objTrace != NULL) {
+        Tcl_DeleteTrace(interp, state->objTrace);
+        state->objTrace = NULL;
+    }
+    state->objTraceKind = TDB_TRACE_NONE;
+}
+
+static void
+Tdb_InstallObjTrace(Tcl_Interp *interp, int kind)
+{
+    TdbState *state = TdbGetState(interp);
+    int flags = 0;
+    /* Coverage and file:line breakpoints must see every command, so they
+     * turn inline compilation off */
+    if (state->perfAllowInline && !(kind & (TDB_TRACE_COVERAGE|TDB_TRACE_FILE))) flags |= TCL_ALLOW_INLINE_COMPILATION;
+    if (state->objTrace != NULL) {
+        if (state->objTraceFlags == flags && state->objTraceKind == kind) return;
+        Tdb_RemoveObjTrace(interp);
+    }
+    state->objTraceFlags = flags;
+    state->objTraceKind = kind;
+    state->objTrace = Tcl_CreateObjTrace(interp, 0, flags, TdbTraceProcForKind(kind), state, NULL);
+}
+
+static void
+TdbRecomputeIdleProc(ClientData cd)
+{
+    TdbState *state = (TdbState *)cd;
+    state->recomputeIdle = 0;
+    Tdb_RecomputeTracing(state->interp);
+}
+
+static void
+Tdb_RecomputeTracing(Tcl_Interp *interp)
+{
+    TdbState *state = TdbGetState(interp);
+    if (state->batchDepth > 0) {
+        /* tdb::break batch/set recompute once when the outermost batch ends */
+        state->recomputePending = 1;
+        return;
+    }
+    if (state->inFileLineHook > 0) {
+        /* Tcl's reverse scan of step traces does not survive deleting the
+         * object trace from its own callback (a oneshot file breakpoint
+         * firing inside a coroutine), so swap it from the idle loop */
+        if (!state->recomputeIdle) {
+            state->recomputeIdle = 1;
+            Tcl_DoWhenIdle(TdbRecomputeIdleProc, state);
+        }
+        return;
+    }
+    state->recomputePending = 0;
+    /* Latency breakpoints on procs that did not exist yet */
+    if (state->numLatencyPending > 0) TdbLatencyRetry(state);
+    TdbLatencyProcHook(state);
+    int kind = TDB_TRACE_NONE;
+    if (state->coverageActive) kind |= TDB_TRACE_COVERAGE;
+    if (state->started && state->methodBreakpointCount > 0) kind |= TDB_TRACE_METHOD;
+    if (state->started && state->haveFileLineBps) kind |= TDB_TRACE_FILE;
+    TdbIndexFileBreakpoints(state);
+    if (kind != TDB_TRACE_NONE) {
+        Tdb_InstallObjTrace(interp, kind);
+    } else {
+        Tdb_RemoveObjTrace(interp);
+    }
+    if (state->started && state->haveProcBps) {
+        /* Attach Tcl exec traces for proc breakpoints */
+        Tcl_EvalEx(interp, "if {[llength [info commands ::tdb::_ensure_exec_traces]]} {::tdb::_ensure_exec_traces}", -1, TCL_EVAL_GLOBAL);
+    }
+}
+
+/* tdb::_match_fileline file line -> 1/0 */
+static int
+TdbMatchFileLineCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    (void)cd;
+    if (objc != 3) {
+        Tcl_WrongNumArgs(interp, 1, objv, "file line");
+        return TCL_ERROR;
+    }
+    TdbState *state = TdbGetState(interp);
+    Tcl_Obj *fileObj = objv[1];
+    int line = -1;
+    if (Tcl_GetIntFromObj(interp, objv[2], &line) != TCL_OK) return TCL_ERROR;
+    if (line <= 0) { Tcl_SetObjResult(interp, Tcl_NewIntObj(0)); return TCL_OK; }
+    /* normalize */
+    Tcl_Obj *norm = Tcl_FSGetNormalizedPath(interp, fileObj);
+    if (norm) fileObj = norm;
+    int match = 0;
+    Tcl_HashSearch search; Tcl_HashEntry *entry = Tcl_FirstHashEntry(&state->breakpoints, &search);
+    while (entry) {
+        TdbBreakpoint *bp = (TdbBreakpoint *)Tcl_GetHashValue(entry);
+        if (bp && bp->type == TDB_BP_FILE && bp->filePath && bp->line == line) {
+            if (Tcl_FSEqualPaths(bp->filePath, fileObj)) { match = 1; break; }
+        }
+        entry = Tcl_NextHashEntry(&search);
+    }
+    Tcl_SetObjResult(interp, Tcl_NewIntObj(match));
+    return TCL_OK;
+}
+
+/* stats command */
+static int
+TdbStatsCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    (void)cd;
+    if (objc != 1) {
+        Tcl_WrongNumArgs(interp, 1, objv, NULL);
+        return TCL_ERROR;
+    }
+    TdbState *state = TdbGetState(interp);
+    Tcl_Obj *dict = Tcl_NewDictObj();
+    /* Proc breakpoints trace through exec traces, without the object trace */
+    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("tracing", -1), Tcl_NewIntObj(state->objTrace != NULL || (state->started && state->haveProcBps)));
+    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("traceKind", -1), Tcl_NewStringObj(tdbTraceKindNames[state->objTraceKind], -1));
+    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("traceHits", -1), Tcl_NewIntObj(state->traceHits));
+    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("frameLookups", -1), Tcl_NewIntObj(state->frameLookups));
+    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("procFastRejects", -1), Tcl_NewIntObj(state->procFastRejects));
+    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("fileFastRejects", -1), Tcl_NewIntObj(state->fileFastRejects));
+    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("eventsQueued", -1), Tcl_NewIntObj(state->eventCount));
+    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("eventsDropped", -1), Tcl_NewIntObj(state->eventsDropped));
+    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("eventsOverrun", -1), Tcl_NewIntObj(state->eventsOverrun));
+    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("budgetOverhead", -1), Tcl_NewDoubleObj(state->budgetLastPct));
+    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("degraded", -1), Tcl_NewIntObj(state->degradedCount));
+    Tcl_SetObjResult(interp, dict);
+    return TCL_OK;
+}
+
+/* tdb::_stop_event <dict> -- internal helper used by Tcl shim to publish
+ * a fully-formed stop event dict (used by exec-trace path for file:line). */
+static int
+TdbStopEventCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    (void)cd;
+    if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "eventDict");
+        return TCL_ERROR;
+    }
+    int size = 0;
+    if (Tcl_DictObjSize(interp, objv[1], &size) != TCL_OK) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("expected dict", -1));
+        return TCL_ERROR;
+    }
+    /* The paused command is the one below the shim proc calling us */
+    TdbState *state = TdbGetState(interp);
+    int stopFrame = TdbStopFrameAt(state, interp, -1, TdbInfoInt(state, interp, TDB_LIT(state, FRAME)));
+    Tdb_SetStopEvent(interp, objv[1], -1, stopFrame);
+    Tcl_SetObjResult(interp, Tcl_NewStringObj("ok", -1));
+    return TCL_OK;
+}
+
+/* tdb::_stop_locals ?-delta? -- full locals snapshot (or the delta) of the
+ * current stop: the one last published or handed out by tdb::wait/tdb::on.
+ * Returns {} when that stop carried no locals. */
+static int
+TdbStopLocalsCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    (void)cd;
+    if (objc > 2 || (objc == 2 && strcmp(Tcl_GetString(objv[1]), "-delta") != 0)) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?-delta?");
+        return TCL_ERROR;
+    }
+    TdbState *state = TdbGetState(interp);
+    Tcl_Obj *result = objc == 2 ? state->lastDelta : state->lastLocals;
+    if (result) Tcl_SetObjResult(interp, result);
+    return TCL_OK;
+}
+
+/* tdb::_log_event <dict> -- queue a non-pausing logpoint event */
+static int
+TdbLogEventCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    (void)cd;
+    if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "eventDict");
+        return TCL_ERROR;
+    }
+    int size = 0;
+    if (Tcl_DictObjSize(interp, objv[1], &size) != TCL_OK) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("expected dict", -1));
+        return TCL_ERROR;
+    }
+    TdbEventPush(TdbGetState(interp), TDB_EV_LOG, objv[1]);
+    Tcl_ResetResult(interp);
+    return TCL_OK;
+}
+
+static void
+TdbWaitTimeoutProc(ClientData cd)
+{
+    *(int *)cd = 1;
+}
+
+static int
+TdbParseEventKind(Tcl_Interp *interp, Tcl_Obj *obj, int allowAny, int *kindPtr)
+{
+    const char *name = Tcl_GetString(obj);
+    if (strcmp(name, "stopped") == 0) { *kindPtr = TDB_EV_STOPPED; return TCL_OK; }
+    if (strcmp(name, "log") == 0) { *kindPtr = TDB_EV_LOG; return TCL_OK; }
+    if (strcmp(name, "degraded") == 0) { *kindPtr = TDB_EV_DEGRADED; return TCL_OK; }
+    if (allowAny && strcmp(name, "any") == 0) { *kindPtr = -1; return TCL_OK; }
+    return TdbError(interp, "EVENT", "KIND", allowAny ? "event kind must be stopped, log, degraded or any" : "event kind must be stopped, log or degraded");
+}
+
+/* tdb::wait ?-timeout ms? ?-event stopped|log|degraded|any? -- block in the notifier
+ * until a queued event of the requested kind is available, then pop it. */
+static int
+TdbWaitCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    (void)cd;
+    TdbState *state = TdbGetState(interp);
+    int timeout = -1, kind = TDB_EV_STOPPED;
+    if ((objc - 1) % 2 != 0) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?-timeout ms? ?-event stopped|log|degraded|any?");
+        Tcl_SetErrorCode(interp, "TDB", "WAIT", "USAGE", NULL);
+        return TCL_ERROR;
+    }
+    for (int i = 1; i < objc; i += 2) {
+        const char *opt = Tcl_GetString(objv[i]);
+        if (strcmp(opt, "-timeout") == 0) {
+            if (Tcl_GetIntFromObj(interp, objv[i+1], &timeout) != TCL_OK) {
+                Tcl_SetErrorCode(interp, "TDB", "WAIT", "VALUE", NULL);
+                return TCL_ERROR;
+            }
+            if (timeout < 0) timeout = 0;
+        } else if (strcmp(opt, "-event") == 0) {
+            if (TdbParseEventKind(interp, objv[i+1], 1, &kind) != TCL_OK) return TCL_ERROR;
+        } else {
+            return TdbError(interp, "WAIT", "OPTION", "unknown option: should be -timeout or -event");
+        }
+    }
+
+    int timedOut = 0;
+    Tcl_TimerToken timer = NULL;
+    if (!TdbEventQueueFind(state, kind) && timeout >= 0) {
+        timer = Tcl_CreateTimerHandler(timeout, TdbWaitTimeoutProc, &timedOut);
+    }
+    Tcl_Preserve(interp);
+    state->waiters++;
+    while (!TdbEventQueueFind(state, kind) && !timedOut) {
+        Tcl_DoOneEvent(TCL_ALL_EVENTS);
+    }
+    state->waiters--;
+    if (timer && !timedOut) Tcl_DeleteTimerHandler(timer);
+
+    TdbQueuedEvent *qe = TdbEventQueueTake(state, kind);
+    Tcl_Release(interp);
+    if (!qe) return TdbError(interp, "TIMEOUT", NULL, "timeout");
+    if (qe->kind == TDB_EV_STOPPED) TdbSyncStoppedVar(state);
+    TdbLocalsDeliver(state, qe);
+    Tcl_SetObjResult(interp, qe->dict);
+    TdbEventFree(qe);
+    return TCL_OK;
+}
+
+/* tdb::on stopped|log|degraded ?cmdPrefix? -- register (or clear with "") a callback
+ * that receives each event of that kind from the notifier instead of the queue. */
+static int
+TdbOnCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    (void)cd;
+    TdbState *state = TdbGetState(interp);
+    int kind;
+    if (objc != 2 && objc != 3) {
+        Tcl_WrongNumArgs(interp, 1, objv, "stopped|log|degraded ?cmdPrefix?");
+        Tcl_SetErrorCode(interp, "TDB", "EVENT", "USAGE", NULL);
+        return TCL_ERROR;
+    }
+    if (TdbParseEventKind(interp, objv[1], 0, &kind) != TCL_OK) return TCL_ERROR;
+    if (objc == 3) {
+        int len = 0;
+        if (Tcl_ListObjLength(interp, objv[2], &len) != TCL_OK) return TCL_ERROR;
+        if (state->onEvent[kind]) Tcl_DecrRefCount(state->onEvent[kind]);
+        state->onEvent[kind] = NULL;
+        if (len > 0) {
+            state->onEvent[kind] = objv[2];
+            Tcl_IncrRefCount(objv[2]);
+            /* Deliver anything already queued */
+            if (TdbEventQueueFind(state, kind)) TdbWakeController(state);
+        }
+    }
+    Tcl_SetObjResult(interp, state->onEvent[kind] ? state->onEvent[kind] : Tcl_NewObj());
+    return TCL_OK;
+}
+
+/* ----------------------------------------------------------------------
+ * Commands: config, start/stop, breakpoint API, _pauseNow
+ * ---------------------------------------------------------------------- */
+
+static int
+TdbConfigExport(TdbState *state, Tcl_Interp *interp)
+{
+    Tcl_Obj *dict = Tcl_NewDictObj();
+    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("-perf.allowInline", -1), Tcl_NewIntObj(state->perfAllowInline));
+    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("-path.normalize", -1), Tcl_NewIntObj(state->pathNormalize));
+    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("-safeEval", -1), Tcl_NewIntObj(state->safeEval));
+    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("-safeEval.poolSize", -1), Tcl_NewIntObj(state->safeEvalPoolSize));
+    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("-safeEval.idleMs", -1), Tcl_NewIntObj(state->safeEvalIdleMs));
+    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("-events.max", -1), Tcl_NewIntObj(state->eventQueueMax));
+    char buf[TCL_DOUBLE_SPACE + 1] = "0";
+    if (state->perfBudget > 0) {
+        Tcl_PrintDouble(NULL, state->perfBudget, buf);
+        strcat(buf, "%");
+    }
+    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("-perf.budget", -1), Tcl_NewStringObj(buf, -1));
+    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("-perf.budgetWindowMs", -1), Tcl_NewIntObj(state->perfBudgetWindowMs));
+    Tcl_SetObjResult(interp, dict);
+    return TCL_OK;
+}
+
+static int
+TdbConfigCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    (void)cd;
+    TdbState *state = TdbGetState(interp);
+    if (objc == 1) return TdbConfigExport(state, interp);
+    if (((objc - 1) % 2) != 0) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?-option value ...?");
+        Tcl_SetErrorCode(interp, "TDB", "CONFIG", "USAGE", NULL);
+        return TCL_ERROR;
+    }
+    for (int i = 1; i < objc; i += 2) {
+        const char *opt = Tcl_GetString(objv[i]);
+        int b;
+        if (strcmp(opt, "-perf.allowInline") == 0) {
+            if (Tcl_GetBooleanFromObj(interp, objv[i+1], &b) != TCL_OK) {
+                Tcl_SetErrorCode(interp, "TDB", "CONFIG", "VALUE", NULL);
+                return TCL_ERROR;
+            }
+            state->perfAllowInline = b ? 1 : 0;
+        } else if (strcmp(opt, "-path.normalize") == 0) {
+            if (Tcl_GetBooleanFromObj(interp, objv[i+1], &b) != TCL_OK) {
+                Tcl_SetErrorCode(interp, "TDB", "CONFIG", "VALUE", NULL);
+                return TCL_ERROR;
+            }
+            state->pathNormalize = b ? 1 : 0;
+        } else if (strcmp(opt, "-safeEval") == 0) {
+            if (Tcl_GetBooleanFromObj(interp, objv[i+1], &b) != TCL_OK) {
+                Tcl_SetErrorCode(interp, "TDB", "CONFIG", "VALUE", NULL);
+                return TCL_ERROR;
+            }
+            state->safeEval = b ? 1 : 0;
+        } else if (strcmp(opt, "-safeEval.poolSize") == 0) {
+            int n;
+            if (Tcl_GetIntFromObj(interp, objv[i+1], &n) != TCL_OK) {
+                Tcl_SetErrorCode(interp, "TDB", "CONFIG", "VALUE", NULL);
+                return TCL_ERROR;
+            }
+            if (n < 0) return TdbError(interp, "CONFIG", "VALUE", "pool size must be >= 0");
+            state->safeEvalPoolSize = n;
+        } else if (strcmp(opt, "-safeEval.idleMs") == 0) {
+            int n;
+            if (Tcl_GetIntFromObj(interp, objv[i+1], &n) != TCL_OK) {
+                Tcl_SetErrorCode(interp, "TDB", "CONFIG", "VALUE", NULL);
+                return TCL_ERROR;
+            }
+            if (n < 0) return TdbError(interp, "CONFIG", "VALUE", "idle timeout must be >= 0");
+            state->safeEvalIdleMs = n;
+        } else if (strcmp(opt, "-events.max") == 0) {
+            int n;
+            if (Tcl_GetIntFromObj(interp, objv[i+1], &n) != TCL_OK) {
+                Tcl_SetErrorCode(interp, "TDB", "CONFIG", "VALUE", NULL);
+                return TCL_ERROR;
+            }
+            if (n < 1) return TdbError(interp, "CONFIG", "VALUE", "event queue length must be >= 1");
+            state->eventQueueMax = n;
+        } else if (strcmp(opt, "-perf.budget") == 0) {
+            /* "5%" or "5"; 0 turns the watchdog off */
+            int len = 0;
+            const char *text = Tcl_GetStringFromObj(objv[i+1], &len);
+            Tcl_Obj *num = Tcl_NewStringObj(text, (len > 0 && text[len-1] == '%') ? len - 1 : len);
+            double pct;
+            Tcl_IncrRefCount(num);
+            int rc = Tcl_GetDoubleFromObj(interp, num, &pct);
+            Tcl_DecrRefCount(num);
+            if (rc != TCL_OK) {
+                Tcl_SetErrorCode(interp, "TDB", "CONFIG", "VALUE", NULL);
+                return TCL_ERROR;
+            }
+            /* Written to fail for NaN as well as out-of-range and infinite values */
+            if (!(pct >= 0 && pct <= 100)) return TdbError(interp, "CONFIG", "VALUE", "budget must be between 0% and 100%");
+            state->perfBudget = pct;
+            state->budgetWindowStart = 0;
+        } else if (strcmp(opt, "-perf.budgetWindowMs") == 0) {
+            int n;
+            if (Tcl_GetIntFromObj(interp, objv[i+1], &n) != TCL_OK) {
+                Tcl_SetErrorCode(interp, "TDB", "CONFIG", "VALUE", NULL);
+                return TCL_ERROR;
+            }
+            if (n < 1) return TdbError(interp, "CONFIG", "VALUE", "budget window must be >= 1 ms");
+            state->perfBudgetWindowMs = n;
+            state->budgetWindowStart = 0;
+        } else {
+            return TdbError(interp, "CONFIG", "OPTION", "unknown configuration option");
+        }
+    }
+    return TdbConfigExport(state, interp);
+}
+
+static int
+TdbStartCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    (void)cd;
+    if (objc != 1) {
+        Tcl_WrongNumArgs(interp, 1, objv, NULL);
+        Tcl_SetErrorCode(interp, "TDB", "START", "USAGE", NULL);
+        return TCL_ERROR;
+    }
+    if (TdbShimLoad(interp) != TCL_OK) return TCL_ERROR;
+    TdbState *state = TdbGetState(interp);
+    state->started = 1;
+    /* Reset counters on (re)start for predictable stats in tests */
+    state->traceHits = 0;
+    state->frameLookups = 0;
+    state->procFastRejects = 0;
+    state->fileFastRejects = 0;
+    state->budgetWindowStart = 0;
+    state->budgetLastPct = 0;
+    state->degradedCount = 0;
+    Tdb_RecomputeTracing(interp);
+    Tcl_ResetResult(interp);
+    return TCL_OK;
+}
+
+static int
+TdbStopCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    (void)cd;
+    if (objc != 1) {
+        Tcl_WrongNumArgs(interp, 1, objv, NULL);
+        Tcl_SetErrorCode(interp, "TDB", "STOP", "USAGE", NULL);
+        return TCL_ERROR;
+    }
+    TdbState *state = TdbGetState(interp);
+    state->started = 0;
+    state->isPaused = 0;
+    /* clear breakpoints and pause state */
+    TdbBreakpointClearAll(state);
+    if (state->lastStopDict) { Tcl_DecrRefCount(state->lastStopDict); state->lastStopDict = NULL; }
+    state->stopFrame = 0;
+    TdbLocalsReset(state);
+    TdbEventQueueClear(state, -1);
+    TdbSyncStoppedVar(state);
+    state->eventsDropped = 0;
+    state->eventsOverrun = 0;
+    Tcl_UnsetVar(interp, TDB_GLOBAL_VAR_RESUME, TCL_GLOBAL_ONLY);
+    /* Release pooled safe children held by the shim */
+    Tcl_EvalEx(interp, "if {[llength [info commands ::tdb::_safeDrain]]} {::tdb::_safeDrain}", -1, TCL_EVAL_GLOBAL);
+    /* Reset counters on stop as well */
+    state->traceHits = 0;
+    state->frameLookups = 0;
+    state->procFastRejects = 0;
+    state->fileFastRejects = 0;
+    Tdb_RecomputeTracing(interp);
+    Tcl_ResetResult(interp);
+    return TCL_OK;
+}
+
+/* Options shared by every breakpoint kind */
+typedef struct {
+    Tcl_Obj *condition;
+    Tcl_Obj *hitCount;
+    Tcl_Obj *logMessage;
+    Tcl_Obj *coroutinePattern;
+    int oneshot;
+} TdbBreakMods;
+
+/* Parse one modifier at objv[*iPtr]; returns TCL_CONTINUE if the option is
+ * not a modifier so the caller can handle it. */
+static int
+TdbParseBreakMod(Tcl_Interp *interp, int objc, Tcl_Obj *const objv[], int *iPtr, TdbBreakMods *mods)
+{
+    int i = *iPtr;
+    const char *opt = Tcl_GetString(objv[i]);
+    if (strcmp(opt, "-condition") == 0) {
+        if (++i >= objc) return TdbError(interp, "BREAK", "USAGE", "missing value for -condition");
+        mods->condition = objv[i];
+    } else if (strcmp(opt, "-hitCount") == 0) {
+        if (++i >= objc) return TdbError(interp, "BREAK", "USAGE", "missing value for -hitCount");
+        mods->hitCount = objv[i];
+    } else if (strcmp(opt, "-oneshot") == 0) {
+        if (++i >= objc) return TdbError(interp, "BREAK", "USAGE", "missing value for -oneshot");
+        if (Tcl_GetBooleanFromObj(interp, objv[i], &mods->oneshot) != TCL_OK) { Tcl_SetErrorCode(interp, "TDB","BREAK","VALUE",NULL); return TCL_ERROR; }
+    } else if (strcmp(opt, "-log") == 0) {
+        if (++i >= objc) return TdbError(interp, "BREAK", "USAGE", "missing value for -log");
+        mods->logMessage = objv[i];
+    } else if (strcmp(opt, "-coroutine") == 0) {
+        if (++i >= objc) return TdbError(interp, "BREAK", "USAGE", "missing value for -coroutine");
+        mods->coroutinePattern = objv[i];
+    } else {
+        return TCL_CONTINUE;
+    }
+    *iPtr = i;
+    return TCL_OK;
+}
+
+/* Allocate a breakpoint, assign its id and register it; does not recompute tracing */
+static TdbBreakpoint *
+TdbBreakpointInsert(TdbState *state, TdbBreakpointType type, const TdbBreakMods *mods)
+{
+    TdbBreakpoint *bp = (TdbBreakpoint *)ckalloc(sizeof(TdbBreakpoint));
+    memset(bp, 0, sizeof(TdbBreakpoint));
+    bp->type = type; bp->id = state->nextBreakpointId++; bp->line = -1;
+    if (mods->condition) { bp->condition = mods->condition; Tcl_IncrRefCount(bp->condition); }
+    if (mods->hitCount) { bp->hitCountSpec = mods->hitCount; Tcl_IncrRefCount(bp->hitCountSpec); }
+    if (mods->logMessage) { bp->logMessage = mods->logMessage; Tcl_IncrRefCount(bp->logMessage); }
+    if (mods->coroutinePattern) { bp->coroutinePattern = mods->coroutinePattern; Tcl_IncrRefCount(bp->coroutinePattern); }
+    bp->oneshot = mods->oneshot ? 1 : 0;
+    bp->hits = 0;
+
+    int isNew = 0;
+    Tcl_HashEntry *entry = Tcl_CreateHashEntry(&state->breakpoints, (const void*)(intptr_t)bp->id, &isNew);
+    Tcl_SetHashValue(entry, bp);
+    TdbAdjustCounts(state, type, +1);
+    TdbBreakListInvalidate(state);
+    if (state->batchDepth > 0 && state->batchAdded) {
+        Tcl_ListObjAppendElement(NULL, state->batchAdded, Tcl_NewIntObj(bp->id));
+    }
+    return bp;
+}
+
+/* Read a whole source file; new refcounted object, NULL if unreadable */
+static Tcl_Obj *
+TdbReadSourceText(Tcl_Obj *pathObj)
+{
+    Tcl_Channel chan = Tcl_FSOpenFileChannel(NULL, pathObj, "r", 0);
+    if (!chan) return NULL;
+    Tcl_Obj *data = Tcl_NewObj();
+    Tcl_IncrRefCount(data);
+    Tcl_ReadChars(chan, data, -1, 0);
+    Tcl_Close(NULL, chan);
+    return data;
+}
+
+/* Read a source file into a list of lines for breakpoint verification; NULL if unreadable */
+static Tcl_Obj *
+TdbReadSourceLines(Tcl_Obj *pathObj)
+{
+    Tcl_Obj *data = TdbReadSourceText(pathObj);
+    if (!data) return NULL;
+    /* Same elements as [split $data \n], without touching the interp result */
+    Tcl_Obj *lines = Tcl_NewListObj(0, NULL);
+    int len = 0;
+    const char *text = Tcl_GetStringFromObj(data, &len);
+    const char *start = text, *end = text + len;
+    for (const char *p = text; p < end; p++) {
+        if (*p == '\n') {
+            Tcl_ListObjAppendElement(NULL, lines, Tcl_NewStringObj(start, (int)(p - start)));
+            start = p + 1;
+        }
+    }
+    Tcl_ListObjAppendElement(NULL, lines, Tcl_NewStringObj(start, (int)(end - start)));
+    Tcl_IncrRefCount(lines);
+    Tcl_DecrRefCount(data);
+    return lines;
+}
+
+/* A file breakpoint is verified when its line exists and holds code */
+static int
+TdbLineVerified(Tcl_Interp *interp, Tcl_Obj *lines, int line)
+{
+    int count = 0;
+    Tcl_Obj *text = NULL;
+    if (!lines || line <= 0) return 0;
+    if (Tcl_ListObjLength(interp, lines, &count) != TCL_OK || line > count) return 0;
+    Tcl_ListObjIndex(interp, lines, line - 1, &text);
+    if (!text) return 0;
+    const char *p = Tcl_GetString(text);
+    while (*p == ' ' || *p == '\t' || *p == '\r') p++;
+    if (*p == '\0' || *p == '#') return 0;
+    /* A line of closing (or opening) braces starts no command */
+    for (const char *q = p; *q; q++) {
+        if (*q != '{' && *q != '}' && *q != ' ' && *q != '\t' && *q != '\r') return 1;
+    }
+    return 0;
+}
+
+static int
+TdbBreakpointVerified(TdbState *state, const TdbBreakpoint *bp, Tcl_Obj *lines)
+{
+    Tcl_CmdInfo info;
+    switch (bp->type) {
+        case TDB_BP_FILE: return TdbLineVerified(state->interp, lines, bp->line);
+        case TDB_BP_PROC: return Tcl_GetCommandInfo(state->interp, Tcl_GetString(bp->procName), &info);
+        case TDB_BP_METHOD: return 1;
+        default: return 0;
+    }
+}
+
+/* {id N type T ?line L? verified 0|1} result entry for set/batch */
+static Tcl_Obj *
+TdbBreakpointResult(TdbState *state, const TdbBreakpoint *bp, Tcl_Obj *lines)
+{
+    Tcl_Interp *interp = state->interp;
+    Tcl_Obj *dict = Tcl_NewDictObj();
+    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("id", -1), Tcl_NewIntObj(bp->id));
+    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("type", -1), Tcl_NewStringObj(bp->type == TDB_BP_FILE ? "file" : bp->type == TDB_BP_PROC ? "proc" : "method", -1));
+    if (bp->type == TDB_BP_FILE) Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("line", -1), Tcl_NewIntObj(bp->line));
+    Tcl_DictObjPut(interp, dict, Tcl_NewStringObj("verified", -1), Tcl_NewBooleanObj(TdbBreakpointVerified(state, bp, lines)));
+    return dict;
+}
+
+static int
+TdbBreakAddCmd(TdbState *state, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    if (objc < 4) {
+        Tcl_WrongNumArgs(interp, 2, objv, "-file|-proc|-method ...");
+        Tcl_SetErrorCode(interp, "TDB", "BREAK", "USAGE", NULL);
+        return TCL_ERROR;
+    }
+    TdbBreakpointType type = TDB_BP_NONE;
+    Tcl_Obj *fileObj = NULL, *procName = NULL, *methodPattern = NULL, *methodName = NULL;
+    Tcl_Obj *slowerThan = NULL;
+    Tcl_WideInt thresholdNs = 0;
+    int action = -1;
+    TdbBreakMods mods;
+    int line = -1;
+    memset(&mods, 0, sizeof(mods));
+    for (int i=2;i<objc;i++) {
+        int rc = TdbParseBreakMod(interp, objc, objv, &i, &mods);
+        if (rc == TCL_OK) continue;
+        if (rc == TCL_ERROR) return TCL_ERROR;
+        const char *opt = Tcl_GetString(objv[i]);
+        if (strcmp(opt, "-file") == 0) {
+            if (++i >= objc) return TdbError(interp, "BREAK", "USAGE", "missing value for -file");
+            if (type != TDB_BP_NONE && type != TDB_BP_FILE) return TdbError(interp, "BREAK", "TARGET", "conflicting breakpoint target options");
+            type = TDB_BP_FILE; fileObj = objv[i];
+        } else if (strcmp(opt, "-line") == 0) {
+            if (++i >= objc) return TdbError(interp, "BREAK", "USAGE", "missing value for -line");
+            if (Tcl_GetIntFromObj(interp, objv[i], &line) != TCL_OK) { Tcl_SetErrorCode(interp, "TDB","BREAK","VALUE",NULL); return TCL_ERROR; }
+        } else if (strcmp(opt, "-proc") == 0) {
+            if (++i >= objc) return TdbError(interp, "BREAK", "USAGE", "missing value for -proc");
+            if (type != TDB_BP_NONE) return TdbError(interp, "BREAK", "TARGET", "conflicting breakpoint target options");
+            type = TDB_BP_PROC; procName = objv[i];
+        } else if (strcmp(opt, "-method") == 0) {
+            if (i+2 >= objc) return TdbError(interp, "BREAK", "USAGE", "missing values for -method");
+            if (type != TDB_BP_NONE) return TdbError(interp, "BREAK", "TARGET", "conflicting breakpoint target options");
+            type = TDB_BP_METHOD; methodPattern = objv[++i]; methodName = objv[++i];
+        } else if (strcmp(opt, "-slowerThan") == 0) {
+            if (++i >= objc) return TdbError(interp, "BREAK", "USAGE", "missing value for -slowerThan");
+            if (TdbParseDuration(interp, objv[i], &thresholdNs) != TCL_OK) return TCL_ERROR;
+            slowerThan = objv[i];
+        } else if (strcmp(opt, "-action") == 0) {
+            static const char *const actions[] = { "stop", "log", "record", NULL };
+            if (++i >= objc) return TdbError(interp, "BREAK", "USAGE", "missing value for -action");
+            if (Tcl_GetIndexFromObj(interp, objv[i], actions, "action", 0, &action) != TCL_OK) {
+                Tcl_SetErrorCode(interp, "TDB", "BREAK", "VALUE", NULL);
+                return TCL_ERROR;
+            }
+        } else {
+            return TdbError(interp, "BREAK", "OPTION", "unknown breakpoint option");
+        }
+    }
+    if (type == TDB_BP_NONE) return TdbError(interp, "BREAK","TARGET","no breakpoint target specified");
+    if (type == TDB_BP_FILE && (!fileObj || line < 0)) return TdbError(interp, "BREAK","TARGET","file breakpoints require -file and -line");
+    if (type == TDB_BP_PROC && !procName) return TdbError(interp, "BREAK","TARGET","proc breakpoints require -proc");
+    if (type == TDB_BP_METHOD && (!methodPattern || !methodName)) return TdbError(interp, "BREAK","TARGET","method breakpoints require -method pattern name");
+    if (slowerThan && type != TDB_BP_PROC) return TdbError(interp, "BREAK","TARGET","-slowerThan requires -proc");
+    if (action >= 0 && !slowerThan) return TdbError(interp, "BREAK","USAGE","-action requires -slowerThan");
+    if (slowerThan) type = TDB_BP_LATENCY;
+
+    TdbBreakpoint *bp = TdbBreakpointInsert(state, type, &mods);
+    bp->line = line;
+    if (fileObj) { bp->filePath = TdbMaybeNormalizePath(state, fileObj); }
+    if (procName) { bp->procName = procName; Tcl_IncrRefCount(bp->procName); }
+    if (methodPattern) { bp->methodPattern = methodPattern; Tcl_IncrRefCount(bp->methodPattern); }
+    if (methodName) { bp->methodName = methodName; Tcl_IncrRefCount(bp->methodName); }
+    if (slowerThan) {
+        bp->slowerThan = slowerThan; Tcl_IncrRefCount(bp->slowerThan);
+        bp->thresholdNs = thresholdNs;
+        /* -log without -action logs; otherwise a slow call stops */
+        bp->action = action >= 0 ? (TdbLatencyAction)action : (mods.logMessage ? TDB_LAT_LOG : TDB_LAT_STOP);
+        TdbLatencyTrace(state, bp, 1);
+    }
+    Tdb_RecomputeTracing(interp);
+
+    Tcl_SetObjResult(interp, Tcl_NewIntObj(bp->id));
+    return TCL_OK;
+}
+
+/* tdb::break set -file f -lines {l ...} ?modifiers? -- atomically replace the
+ * file breakpoints of one file; returns one result dict per line. */
+static int
+TdbBreakSetCmd(TdbState *state, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    Tcl_Obj *fileObj = NULL, *linesObj = NULL;
+    TdbBreakMods mods;
+    memset(&mods, 0, sizeof(mods));
+    for (int i=2;i<objc;i++) {
+        int rc = TdbParseBreakMod(interp, objc, objv, &i, &mods);
+        if (rc == TCL_OK) continue;
+        if (rc == TCL_ERROR) return TCL_ERROR;
+        const char *opt = Tcl_GetString(objv[i]);
+        if (strcmp(opt, "-file") == 0) {
+            if (++i >= objc) return TdbError(interp, "BREAK", "USAGE", "missing value for -file");
+            fileObj = objv[i];
+        } else if (strcmp(opt, "-lines") == 0) {
+            if (++i >= objc) return TdbError(interp, "BREAK", "USAGE", "missing value for -lines");
+            linesObj = objv[i];
+        } else {
+            return TdbError(interp, "BREAK", "OPTION", "unknown breakpoint option");
+        }
+    }
+    if (!fileObj || !linesObj) return TdbError(interp, "BREAK", "USAGE", "break set requires -file and -lines");
+    int nlines = 0; Tcl_Obj **lineObjs = NULL;
+    if (Tcl_ListObjGetElements(interp, linesObj, &nlines, &lineObjs) != TCL_OK) { Tcl_SetErrorCode(interp, "TDB","BREAK","VALUE",NULL); return TCL_ERROR; }
+    int *lineNums = (int *)ckalloc(sizeof(int) * (nlines > 0 ? nlines : 1));
+    for (int i=0;i<nlines;i++) {
+        if (Tcl_GetIntFromObj(interp, lineObjs[i], &lineNums[i]) != TCL_OK || lineNums[i] < 0) {
+            ckfree(lineNums);
+            return TdbError(interp, "BREAK", "VALUE", "-lines must be a list of line numbers");
+        }
+    }
+
+    Tcl_Obj *path = TdbMaybeNormalizePath(state, fileObj);
+    state->batchDepth++;
+    /* Drop the file's current breakpoints */
+    Tcl_HashSearch search;
+    Tcl_HashEntry *entry = Tcl_FirstHashEntry(&state->breakpoints, &search);
+    while (entry) {
+        Tcl_HashEntry *next = Tcl_NextHashEntry(&search);
+        TdbBreakpoint *bp = (TdbBreakpoint *)Tcl_GetHashValue(entry);
+        if (bp && bp->type == TDB_BP_FILE && bp->filePath && Tcl_FSEqualPaths(bp->filePath, path)) {
+            TdbRemoveBreakpointEntry(state, entry);
+        }
+        entry = next;
+    }
+    Tcl_Obj *source = TdbReadSourceLines(path);
+    Tcl_Obj *result = Tcl_NewListObj(0, NULL);
+    for (int i=0;i<nlines;i++) {
+        TdbBreakpoint *bp = TdbBreakpointInsert(state, TDB_BP_FILE, &mods);
+        bp->line = lineNums[i];
+        bp->filePath = path; Tcl_IncrRefCount(path);
+        Tcl_ListObjAppendElement(interp, result, TdbBreakpointResult(state, bp, source));
+    }
+    if (source) Tcl_DecrRefCount(source);
+    Tcl_DecrRefCount(path);
+    ckfree(lineNums);
+    state->batchDepth--;
+    Tdb_RecomputeTracing(interp);
+    Tcl_SetObjResult(interp, result);
+    return TCL_OK;
+}
+
+/* tdb::break batch script -- evaluate script with tracing recompute deferred
+ * to a single pass; returns result dicts for the breakpoints it added. */
+static int
+TdbBreakBatchCmd(TdbState *state, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    if (objc != 3) { Tcl_WrongNumArgs(interp, 2, objv, "script"); Tcl_SetErrorCode(interp, "TDB","BREAK","USAGE",NULL); return TCL_ERROR; }
+    int outermost = (state->batchDepth == 0);
+    if (outermost) {
+        if (state->batchAdded) Tcl_DecrRefCount(state->batchAdded);
+        state->batchAdded = Tcl_NewListObj(0, NULL);
+        Tcl_IncrRefCount(state->batchAdded);
+    }
+    state->batchDepth++;
+    int code = Tcl_EvalObjEx(interp, objv[2], 0);
+    state->batchDepth--;
+    if (!outermost) return code;
+
+    Tcl_Obj *added = state->batchAdded;
+    state->batchAdded = NULL;
+    if (code != TCL_OK) {
+        Tcl_InterpState saved = Tcl_SaveInterpState(interp, code);
+        if (state->recomputePending) Tdb_RecomputeTracing(interp);
+        Tcl_DecrRefCount(added);
+        return Tcl_RestoreInterpState(interp, saved);
+    }
+    if (state->recomputePending) Tdb_RecomputeTracing(interp);
+    /* Verify once per distinct file */
+    Tcl_Obj *result = Tcl_NewListObj(0, NULL);
+    Tcl_Obj *sourcePath = NULL, *source = NULL;
+    int n = 0; Tcl_Obj **ids = NULL;
+    Tcl_ListObjGetElements(NULL, added, &n, &ids);
+    for (int i=0;i<n;i++) {
+        int id = 0;
+        Tcl_GetIntFromObj(NULL, ids[i], &id);
+        Tcl_HashEntry *entry = Tcl_FindHashEntry(&state->breakpoints, (const void*)(intptr_t)id);
+        if (!entry) continue; /* removed again inside the batch */
+        TdbBreakpoint *bp = (TdbBreakpoint *)Tcl_GetHashValue(entry);
+        if (bp->type == TDB_BP_FILE && (!sourcePath || !Tcl_FSEqualPaths(sourcePath, bp->filePath))) {
+            if (source) Tcl_DecrRefCount(source);
+            sourcePath = bp->filePath;
+            source = TdbReadSourceLines(sourcePath);
+        }
+        Tcl_ListObjAppendElement(interp, result, TdbBreakpointResult(state, bp, source));
+    }
+    if (source) Tcl_DecrRefCount(source);
+    Tcl_DecrRefCount(added);
+    Tcl_SetObjResult(interp, result);
+    return TCL_OK;
+}
+
+static int
+TdbBreakRmCmd(TdbState *state, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    if (objc != 3) { Tcl_WrongNumArgs(interp, 2, objv, "id"); Tcl_SetErrorCode(interp, "TDB","BREAK","USAGE",NULL); return TCL_ERROR; }
+    int id = 0; if (Tcl_GetIntFromObj(interp, objv[2], &id) != TCL_OK) { Tcl_SetErrorCode(interp, "TDB","BREAK","VALUE",NULL); return TCL_ERROR; }
+    Tcl_HashEntry *entry = Tcl_FindHashEntry(&state->breakpoints, (const void*)(intptr_t)id);
+    if (!entry) return TdbError(interp, "BREAK","UNKNOWN","breakpoint id not found");
+    TdbRemoveBreakpointEntry(state, entry);
+    Tdb_RecomputeTracing(interp);
+    Tcl_SetObjResult(interp, Tcl_NewIntObj(id));
+    return TCL_OK;
+}
+
+static int
+TdbBreakClearCmd(TdbState *state, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    if (objc != 2) { Tcl_WrongNumArgs(interp, 2, objv, NULL); Tcl_SetErrorCode(interp, "TDB","BREAK","USAGE",NULL); return TCL_ERROR; }
+    TdbBreakpointClearAll(state);
+    Tdb_RecomputeTracing(interp);
+    Tcl_ResetResult(interp);
+    return TCL_OK;
+}
+
+static int CompareInts(const void *a, const void *b) { int ia=*(const int*)a, ib=*(const int*)b; return ia<ib?-1:ia>ib?1:0; }
+
+/* All breakpoint dicts in id order, without live counters, with
+ * state->bpOrder listing the breakpoints behind them; rebuilt only after
+ * TdbBreakListInvalidate */
+static Tcl_Obj *
+TdbBreakList(TdbState *state, Tcl_Interp *interp)
+{
+    if (state->bpListCache) return state->bpListCache;
+    Tcl_Obj *list = Tcl_NewListObj(0, NULL);
+    int count = state->breakpoints.numEntries;
+    if (count > 0) {
+        Tcl_HashSearch search;
+        int *ids = (int*)ckalloc(sizeof(int)*count); int idx=0;
+        for (Tcl_HashEntry *entry = Tcl_FirstHashEntry(&state->breakpoints, &search); entry; entry = Tcl_NextHashEntry(&search)) {
+            ids[idx++] = (int)(intptr_t)Tcl_GetHashKey(&state->breakpoints, entry);
+        }
+        qsort(ids, count, sizeof(int), CompareInts);
+        if (count > state->bpOrderCap) {
+            state->bpOrderCap = count;
+            state->bpOrder = (TdbBreakpoint **)ckrealloc((char *)state->bpOrder, count * sizeof(TdbBreakpoint *));
+        }
+        for (int i=0;i<count;i++) {
+            TdbBreakpoint *bp = (TdbBreakpoint*)Tcl_GetHashValue(Tcl_FindHashEntry(&state->breakpoints, (const void*)(intptr_t)ids[i]));
+            state->bpOrder[i] = bp;
+            Tcl_ListObjAppendElement(interp, list, TdbBreakpointToDict(interp, bp));
+        }
+        ckfree(ids);
+    }
+    state->bpListCache = list;
+    Tcl_IncrRefCount(list);
+    return list;
+}
+
+static int
+TdbBreakListCmd(TdbState *state, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    if (objc != 2) { Tcl_WrongNumArgs(interp, 2, objv, NULL); Tcl_SetErrorCode(interp, "TDB","BREAK","USAGE",NULL); return TCL_ERROR; }
+    Tcl_Obj *list = TdbBreakList(state, interp);
+    Tcl_Obj **dicts = NULL;
+    int count = 0, i;
+    Tcl_ListObjGetElements(NULL, list, &count, &dicts);
+    for (i = 0; i < count && !TdbBreakpointHasLive(state->bpOrder[i]); i++) {}
+    if (i < count) {
+        /* Share the cached dicts of breakpoints without live counters */
+        Tcl_Obj *live = Tcl_NewListObj(count, dicts);
+        for (; i < count; i++) {
+            if (!TdbBreakpointHasLive(state->bpOrder[i])) continue;
+            Tcl_Obj *d = TdbBreakpointLive(state, state->bpOrder[i], dicts[i]);
+            Tcl_ListObjReplace(NULL, live, i, 1, 1, &d);
+        }
+        list = live;
+    }
+    Tcl_SetObjResult(interp, list);
+    return TCL_OK;
+}
+
+/* tdb::break get id -- one breakpoint's dict */
+static int
+TdbBreakGetCmd(TdbState *state, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    if (objc != 3) { Tcl_WrongNumArgs(interp, 2, objv, "id"); Tcl_SetErrorCode(interp, "TDB","BREAK","USAGE",NULL); return TCL_ERROR; }
+    int id = 0; if (Tcl_GetIntFromObj(interp, objv[2], &id) != TCL_OK) { Tcl_SetErrorCode(interp, "TDB","BREAK","VALUE",NULL); return TCL_ERROR; }
+    if (!Tcl_FindHashEntry(&state->breakpoints, (const void*)(intptr_t)id)) return TdbError(interp, "BREAK","UNKNOWN","breakpoint id not found");
+    Tcl_Obj *list = TdbBreakList(state, interp);
+    Tcl_Obj **dicts = NULL;
+    int count = 0, lo = 0, hi;
+    Tcl_ListObjGetElements(NULL, list, &count, &dicts);
+    for (hi = count - 1; lo < hi; ) {
+        int mid = (lo + hi) / 2;
+        if (state->bpOrder[mid]->id < id) lo = mid + 1; else hi = mid;
+    }
+    Tcl_SetObjResult(interp, TdbBreakpointLive(state, state->bpOrder[lo], dicts[lo]));
+    return TCL_OK;
+}
+
+/* -proc matching used by the shim: the exact name, or the breakpoint's
+ * name without its leading colons */
+static int
+TdbBreakProcMatches(const char *bpName, const char *name)
+{
+    if (strcmp(bpName, name) == 0) return 1;
+    if (bpName[0] != ':' || bpName[1] != ':') return 0;
+    while (*bpName == ':') bpName++;
+    return strcmp(bpName, name) == 0;
+}
+
+/* tdb::break query ?-type file|proc|method? ?-file path? ?-proc name?
+ * ?-method name? -- the ls dicts of matching breakpoints, in id order */
+static int
+TdbBreakQueryCmd(TdbState *state, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    static const char *const types[] = { "file", "proc", "method", NULL };
+    int type = -1;
+    Tcl_Obj *fileObj = NULL, *procObj = NULL, *methodObj = NULL;
+    for (int i=2;i<objc;i++) {
+        const char *opt = Tcl_GetString(objv[i]);
+        if (i + 1 >= objc) {
+            Tcl_WrongNumArgs(interp, 2, objv, "?-type file|proc|method? ?-file path? ?-proc name? ?-method name?");
+            Tcl_SetErrorCode(interp, "TDB","BREAK","USAGE",NULL);
+            return TCL_ERROR;
+        }
+        if (strcmp(opt, "-type") == 0) {
+            if (Tcl_GetIndexFromObj(interp, objv[++i], types, "type", 0, &type) != TCL_OK) {
+                Tcl_SetErrorCode(interp, "TDB","BREAK","VALUE",NULL);
+                return TCL_ERROR;
+            }
+        } else if (strcmp(opt, "-file") == 0) {
+            fileObj = objv[++i];
+        } else if (strcmp(opt, "-proc") == 0) {
+            procObj = objv[++i];
+        } else if (strcmp(opt, "-method") == 0) {
+            methodObj = objv[++i];
+        } else {
+            return TdbError(interp, "BREAK", "OPTION", "unknown query option");
+        }
+    }
+    Tcl_Obj *list = TdbBreakList(state, interp);
+    Tcl_Obj **dicts = NULL;
+    int count = 0;
+    Tcl_ListObjGetElements(NULL, list, &count, &dicts);
+    Tcl_Obj *result = Tcl_NewListObj(0, NULL);
+    for (int i=0;i<count;i++) {
+        TdbBreakpoint *bp = state->bpOrder[i];
+        if (type == 0 && bp->type != TDB_BP_FILE) continue;
+        if (type == 1 && bp->type != TDB_BP_PROC && bp->type != TDB_BP_LATENCY) continue;
+        if (type == 2 && bp->type != TDB_BP_METHOD) continue;
+        if (fileObj && (!bp->filePath || !Tcl_FSEqualPaths(bp->filePath, fileObj))) continue;
+        if (procObj && (!bp->procName || !TdbBreakProcMatches(Tcl_GetString(bp->procName), Tcl_GetString(procObj)))) continue;
+        if (methodObj && (!bp->methodName || strcmp(Tcl_GetString(bp->methodName), Tcl_GetString(methodObj)) != 0)) continue;
+        Tcl_ListObjAppendElement(interp, result, TdbBreakpointLive(state, bp, dicts[i]));
+    }
+    Tcl_SetObjResult(interp, result);
+    return TCL_OK;
+}
+
+/* tdb::_proc_bps name -- [tdb::break query -type proc -proc name] for
+ * ::tdb::_execStep; an entry matching no breakpoint counts as a
+ * procFastRejects */
+static int
+TdbProcBpsCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    (void)cd;
+    if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "name");
+        return TCL_ERROR;
+    }
+    TdbState *state = TdbGetState(interp);
+    Tcl_Obj *qv[6];
+    qv[0] = objv[0];
+    qv[1] = Tcl_NewStringObj("query", -1);
+    qv[2] = Tcl_NewStringObj("-type", -1);
+    qv[3] = TDB_LIT(state, PROC);
+    qv[4] = Tcl_NewStringObj("-proc", -1);
+    qv[5] = objv[1];
+    for (int i = 0; i < 6; i++) Tcl_IncrRefCount(qv[i]);
+    int code = TdbBreakQueryCmd(state, interp, 6, qv);
+    for (int i = 0; i < 6; i++) Tcl_DecrRefCount(qv[i]);
+    int n = 0;
+    if (code == TCL_OK && Tcl_ListObjLength(NULL, Tcl_GetObjResult(interp), &n) == TCL_OK && n == 0) state->procFastRejects++;
+    return code;
+}
+
+static int
+TdbBreakCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    (void)cd; TdbState *state = TdbGetState(interp);
+    if (objc < 2) { Tcl_WrongNumArgs(interp, 1, objv, "add|set|batch|rm|clear|ls|get|query|generation ..."); Tcl_SetErrorCode(interp, "TDB","BREAK","USAGE",NULL); return TCL_ERROR; }
+    const char *sub = Tcl_GetString(objv[1]);
+    if (strcmp(sub,"add")==0) return TdbBreakAddCmd(state, interp, objc, objv);
+    if (strcmp(sub,"set")==0) return TdbBreakSetCmd(state, interp, objc, objv);
+    if (strcmp(sub,"batch")==0) return TdbBreakBatchCmd(state, interp, objc, objv);
+    if (strcmp(sub,"rm")==0) return TdbBreakRmCmd(state, interp, objc, objv);
+    if (strcmp(sub,"clear")==0) return TdbBreakClearCmd(state, interp, objc, objv);
+    if (strcmp(sub,"ls")==0) return TdbBreakListCmd(state, interp, objc, objv);
+    if (strcmp(sub,"get")==0) return TdbBreakGetCmd(state, interp, objc, objv);
+    if (strcmp(sub,"query")==0) return TdbBreakQueryCmd(state, interp, objc, objv);
+    if (strcmp(sub,"generation")==0) {
+        if (objc != 2) { Tcl_WrongNumArgs(interp, 2, objv, NULL); Tcl_SetErrorCode(interp, "TDB","BREAK","USAGE",NULL); return TCL_ERROR; }
+        Tcl_SetObjResult(interp, Tcl_NewWideIntObj(state->bpGeneration));
+        return TCL_OK;
+    }
+    return TdbError(interp, "BREAK","SUBCOMMAND","unknown breakpoint subcommand");
+}
+
+/* ----------------------------------------------------------------------
+ * Commands: coverage
+ * ---------------------------------------------------------------------- */
+
+/* Flat {line 0|1 ...} list over lines that hold code or were executed */
+static Tcl_Obj *
+TdbCoverageLines(TdbCoverageFile *cf, int *foundPtr, int *hitPtr)
+{
+    Tcl_Obj *out = Tcl_NewListObj(0, NULL);
+    *foundPtr = 0; *hitPtr = 0;
+    for (int l = 1; l < cf->numLines; l++) {
+        if (!cf->isCode[l] && !cf->hit[l]) continue;
+        (*foundPtr)++;
+        if (cf->hit[l]) (*hitPtr)++;
+        Tcl_ListObjAppendElement(NULL, out, Tcl_NewIntObj(l));
+        Tcl_ListObjAppendElement(NULL, out, Tcl_NewIntObj(cf->hit[l]));
+    }
+    return out;
+}
+
+/* ----------------------------------------------------------------------
+ * JSON encoding (tdb::json, tdb::event -format json)
+ *
+ * Values are encoded from their internal representation without
+ * shimmering: dicts become objects, lists arrays, integers and finite
+ * doubles numbers, and everything else (including pure strings that look
+ * like lists) a string. Output goes to a Tcl_DString that is flushed to a
+ * channel in chunks when streaming.
+ *
+ * A caller that knows the shape of its value passes a schema instead, so
+ * the output does not depend on representations:
+ *   any                  by internal representation (the default)
+ *   string               always a string
+ *   array ?elem?         a list, each element encoded with `elem`
+ *   object ?fields?      a dict; `fields` maps keys to schemas (others: any)
+ *   dict ?value?         a dict, every value encoded with `value`
+ * tdb::event and tdb::frames use the TDB_LIT_JSON_* schemas.
+ * ---------------------------------------------------------------------- */
+
+
+#define TDB_JSON_CHUNK 65536
+#define TDB_JSON_DEPTH 32             /* deeper values are encoded as strings */
+#define TDB_JSON_MAX_BYTES (64 << 20)
+
+static const Tcl_ObjType *tdbDictType, *tdbListType, *tdbIntType, *tdbWideIntType,
+    *tdbDoubleType;
+
+typedef struct {
+    Tcl_DString buf;
+    Tcl_Channel chan;        /* NULL: collect everything in buf */
+    Tcl_WideInt flushed;     /* UTF-8 bytes already handed to chan */
+    Tcl_WideInt maxBytes;
+    int holdAll;             /* explicit -maxBytes: write chan only once it fits */
+    int maxDepth;
+    int overflow;            /* output would exceed maxBytes */
+    int ioError;
+    Tcl_Obj *schema;         /* NULL: any */
+} TdbJsonWriter;
+
+typedef enum {
+    TDB_JSON_ANY, TDB_JSON_STRING, TDB_JSON_ARRAY, TDB_JSON_OBJECT, TDB_JSON_DICT
+} TdbJsonKind;
+
+static const char *const tdbJsonKindNames[] = { "any", "string", "array", "object", "dict", NULL };
+
+/* Kind of a schema and its argument (element, field or value schema) */
+static TdbJsonKind
+TdbJsonSchemaKind(Tcl_Obj *schema, Tcl_Obj **argPtr)
+{
+    Tcl_Obj **words = NULL;
+    int n = 0;
+    *argPtr = NULL;
+    if (schema == NULL || Tcl_ListObjGetElements(NULL, schema, &n, &words) != TCL_OK || n == 0) {
+        return TDB_JSON_ANY;
+    }
+    const char *name = Tcl_GetString(words[0]);
+    for (int k = 0; tdbJsonKindNames[k] != NULL; k++) {
+        if (strcmp(name, tdbJsonKindNames[k]) == 0) {
+            if (n > 1) *argPtr = words[1];
+            return (TdbJsonKind)k;
+        }
+    }
+    return TDB_JSON_ANY;
+}
+
+/* Validate a -schema value before anything is written */
+static int
+TdbJsonSchemaCheck(Tcl_Interp *interp, Tcl_Obj *schema, int depth)
+{
+    Tcl_Obj **words = NULL;
+    int n = 0, kind = 0;
+    if (depth > TDB_JSON_DEPTH || Tcl_ListObjGetElements(NULL, schema, &n, &words) != TCL_OK || n < 1 || n > 2 ||
+        Tcl_GetIndexFromObj(NULL, words[0], tdbJsonKindNames, "kind", 0, &kind) != TCL_OK ||
+        (n == 2 && (kind == TDB_JSON_ANY || kind == TDB_JSON_STRING))) {
+        return TdbError(interp, "JSON", "SCHEMA",
+            "bad schema: should be any, string, array ?elem?, object ?fields? or dict ?value?");
+    }
+    if (n == 1) return TCL_OK;
+    if (kind != TDB_JSON_OBJECT) return TdbJsonSchemaCheck(interp, words[1], depth + 1);
+    Tcl_DictSearch search;
+    Tcl_Obj *key, *value;
+    int done = 0;
+    if (Tcl_DictObjFirst(NULL, words[1], &search, &key, &value, &done) != TCL_OK) {
+        return TdbError(interp, "JSON", "SCHEMA", "bad schema: object fields must be a dict");
+    }
+    for (; !done; Tcl_DictObjNext(&search, &key, &value, &done)) {
+        if (TdbJsonSchemaCheck(interp, value, depth + 1) != TCL_OK) {
+            Tcl_DictObjDone(&search);
+            return TCL_ERROR;
+        }
+    }
+    return TCL_OK;
+}
+
+typedef void (TdbJsonEmitProc)(void *ctx, const char *bytes, int len);
+
+/* JSON string escaping; Tcl's internal NUL (C0 80) becomes \u0000 */
+static void
+TdbJsonEscape(const char *s, int len, TdbJsonEmitProc *emit, void *ctx)
+{
+    const char *run = s, *end = s + len;
+    emit(ctx, "\"", 1);
+    for (const char *p = s; p < end; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c != '"' && c != '\\' && c >= 0x20 && c != 0xC0) continue;
+        if (c == 0xC0 && (p + 1 >= end || (unsigned char)p[1] != 0x80)) continue;
+        emit(ctx, run, (int)(p - run));
+        if (c == '"') emit(ctx, "\\\"", 2);
+        else if (c == '\\') emit(ctx, "\\\\", 2);
+        else if (c == '\n') emit(ctx, "\\n", 2);
+        else if (c == '\t') emit(ctx, "\\t", 2);
+        else if (c == '\r') emit(ctx, "\\r", 2);
+        else if (c == 0xC0) { emit(ctx, "\\u0000", 6); p++; }
+        else { char buf[8]; snprintf(buf, sizeof(buf), "\\u%04x", c); emit(ctx, buf, 6); }
+        run = p + 1;
+    }
+    emit(ctx, run, (int)(end - run));
+    emit(ctx, "\"", 1);
+}
+
+static void
+TdbJsonEmitObj(void *ctx, const char *bytes, int len)
+{
+    Tcl_AppendToObj((Tcl_Obj *)ctx, bytes, len);
+}
+
+static void
+TdbJsonAppendString(Tcl_Obj *out, const char *s, int len)
+{
+    TdbJsonEscape(s, len, TdbJsonEmitObj, out);
+}
+
+static void
+TdbJsonEmit(void *ctx, const char *bytes, int len)
+{
+    TdbJsonWriter *w = (TdbJsonWriter *)ctx;
+    if (w->overflow || len <= 0) return;
+    if (w->maxBytes > 0 && w->flushed + Tcl_DStringLength(&w->buf) + len > w->maxBytes) {
+        w->overflow = 1;
+        return;
+    }
+    Tcl_DStringAppend(&w->buf, bytes, len);
+    if (w->chan && !w->holdAll && Tcl_DStringLength(&w->buf) >= TDB_JSON_CHUNK) {
+        if (Tcl_WriteChars(w->chan, Tcl_DStringValue(&w->buf), Tcl_DStringLength(&w->buf)) < 0) w->ioError = 1;
+        w->flushed += Tcl_DStringLength(&w->buf);
+        Tcl_DStringSetLength(&w->buf, 0);
+    }
+}
+
+/* -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)? */
+static int
+TdbJsonIsNumber(const char *s, int len)
+{
+    const char *p = s, *end = s + len;
+    if (p < end && *p == '-') p++;
+    if (p >= end) return 0;
+    if (*p == '0') p++;
+    else if (*p >= '1' && *p <= '9') { while (p < end && *p >= '0' && *p <= '9') p++; }
+    else return 0;
+    if (p < end && *p == '.') {
+        if (++p >= end || *p < '0' || *p > '9') return 0;
+        while (p < end && *p >= '0' && *p <= '9') p++;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) p++;
+        if (p >= end || *p < '0' || *p > '9') return 0;
+        while (p < end && *p >= '0' && *p <= '9') p++;
+    }
+    return p == end;
+}
+
+static void
+TdbJsonEncode(TdbJsonWriter *w, Tcl_Obj *obj, int depth, Tcl_Obj *schema)
+{
+    const Tcl_ObjType *t = obj->typePtr;
+    Tcl_Obj *arg = NULL;
+    TdbJsonKind kind = TdbJsonSchemaKind(schema, &arg);
+    int len = 0;
+    if (w->overflow) return;
+    if (kind == TDB_JSON_STRING || depth >= w->maxDepth) {
+        /* string */
+    } else if (kind == TDB_JSON_OBJECT || kind == TDB_JSON_DICT || (kind == TDB_JSON_ANY && t != NULL && t == tdbDictType)) {
+        Tcl_DictSearch search;
+        Tcl_Obj *key, *value, *sub;
+        int done = 0, first = 1;
+        if (Tcl_DictObjFirst(NULL, obj, &search, &key, &value, &done) == TCL_OK) {
+            TdbJsonEmit(w, "{", 1);
+            for (; !done && !w->overflow; Tcl_DictObjNext(&search, &key, &value, &done)) {
+                const char *k = Tcl_GetStringFromObj(key, &len);
+                if (!first) TdbJsonEmit(w, ",", 1);
+                first = 0;
+                TdbJsonEscape(k, len, TdbJsonEmit, w);
+                TdbJsonEmit(w, ":", 1);
+                sub = NULL;
+                if (kind == TDB_JSON_DICT) sub = arg;
+                else if (kind == TDB_JSON_OBJECT && arg) Tcl_DictObjGet(NULL, arg, key, &sub);
+                TdbJsonEncode(w, value, depth + 1, sub);
+            }
+            Tcl_DictObjDone(&search);
+            TdbJsonEmit(w, "}", 1);
+            return;
+        }
+    } else if (kind == TDB_JSON_ARRAY || (kind == TDB_JSON_ANY && t != NULL && t == tdbListType)) {
+        Tcl_Obj **elems = NULL;
+        if (Tcl_ListObjGetElements(NULL, obj, &len, &elems) == TCL_OK) {
+            TdbJsonEmit(w, "[", 1);
+            for (int i = 0; i < len && !w->overflow; i++) {
+                if (i > 0) TdbJsonEmit(w, ",", 1);
+                TdbJsonEncode(w, elems[i], depth + 1, arg);
+            }
+            TdbJsonEmit(w, "]", 1);
+            return;
+        }
+    } else if (t != NULL && (t == tdbIntType || t == tdbWideIntType || t == tdbDoubleType ||
+                             strcmp(t->name, "bignum") == 0)) {
+        /* Numbers keep their text, so 0x10 or Inf stay strings */
+        const char *s = Tcl_GetStringFromObj(obj, &len);
+        if (TdbJsonIsNumber(s, len)) {
+            TdbJsonEmit(w, s, len);
+            return;
+        }
+    }
+    const char *s = Tcl_GetStringFromObj(obj, &len);
+    TdbJsonEscape(s, len, TdbJsonEmit, w);
+}
+
+/* Parse ?-depth n? ?-maxBytes n? ?-channel chan? ?-schema schema? from
+ * objv[i...] up to objc, leaving the writer ready for TdbJsonFinish */
+static int
+TdbJsonOptions(Tcl_Interp *interp, int objc, Tcl_Obj *const objv[], int i, TdbJsonWriter *w)
+{
+    w->chan = NULL;
+    w->flushed = 0;
+    w->maxBytes = TDB_JSON_MAX_BYTES;
+    w->holdAll = 0;
+    w->maxDepth = TDB_JSON_DEPTH;
+    w->overflow = 0;
+    w->ioError = 0;
+    w->schema = NULL;
+    for (; i < objc; i += 2) {
+        const char *opt = Tcl_GetString(objv[i]);
+        if (i + 1 >= objc) return TdbError(interp, "JSON", "USAGE", "missing value for option");
+        if (strcmp(opt, "-depth") == 0) {
+            if (Tcl_GetIntFromObj(interp, objv[i+1], &w->maxDepth) != TCL_OK) {
+                Tcl_SetErrorCode(interp, "TDB", "JSON", "VALUE", NULL);
+                return TCL_ERROR;
+            }
+            if (w->maxDepth < 0) w->maxDepth = 0;
+        } else if (strcmp(opt, "-maxBytes") == 0) {
+            if (Tcl_GetWideIntFromObj(interp, objv[i+1], &w->maxBytes) != TCL_OK) {
+                Tcl_SetErrorCode(interp, "TDB", "JSON", "VALUE", NULL);
+                return TCL_ERROR;
+            }
+            /* A caller-chosen limit is checked before anything reaches the
+             * channel, so TDB JSON SIZE never leaves partial output */
+            w->holdAll = (w->maxBytes > 0);
+        } else if (strcmp(opt, "-channel") == 0) {
+            int mode = 0;
+            w->chan = Tcl_GetChannel(interp, Tcl_GetString(objv[i+1]), &mode);
+            if (w->chan == NULL) {
+                Tcl_SetErrorCode(interp, "TDB", "JSON", "CHANNEL", NULL);
+                return TCL_ERROR;
+            }
+            if (!(mode & TCL_WRITABLE)) return TdbError(interp, "JSON", "CHANNEL", "channel is not writable");
+        } else if (strcmp(opt, "-schema") == 0) {
+            if (TdbJsonSchemaCheck(interp, objv[i+1], 0) != TCL_OK) return TCL_ERROR;
+            w->schema = objv[i+1];
+        } else {
+            return TdbError(interp, "JSON", "OPTION", "unknown option: should be -depth, -maxBytes, -channel or -schema");
+        }
+    }
+    Tcl_DStringInit(&w->buf);
+    return TCL_OK;
+}
+
+/* Encode value with the writer's schema and set the result: the JSON
+ * text, or its length when streaming to a channel. The length (like
+ * -maxBytes) counts the UTF-8 bytes of the text, not the bytes the
+ * channel writes after its -encoding. */
+static int
+TdbJsonFinish(Tcl_Interp *interp, TdbJsonWriter *w, Tcl_Obj *value)
+{
+    TdbJsonEncode(w, value, 0, w->schema);
+    if (w->overflow) {
+        Tcl_DStringFree(&w->buf);
+        return TdbError(interp, "JSON", "SIZE", "JSON output exceeds -maxBytes");
+    }
+    if (w->chan == NULL) {
+        Tcl_DStringResult(interp, &w->buf);
+        return TCL_OK;
+    }
+    Tcl_WideInt total = w->flushed + Tcl_DStringLength(&w->buf);
+    if (Tcl_DStringLength(&w->buf) > 0 &&
+        Tcl_WriteChars(w->chan, Tcl_DStringValue(&w->buf), Tcl_DStringLength(&w->buf)) < 0) {
+        w->ioError = 1;
+    }
+    Tcl_DStringFree(&w->buf);
+    if (w->ioError) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj(Tcl_PosixError(interp), -1));
+        Tcl_SetErrorCode(interp, "TDB", "JSON", "IO", NULL);
+        return TCL_ERROR;
+    }
+    Tcl_SetObjResult(interp, Tcl_NewWideIntObj(total));
     return TCL_OK;
 }
 
+/* tdb::json ?-depth n? ?-maxBytes n? ?-channel chan? ?-schema schema? value */
 static int
-TdbStopCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+TdbJsonCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
 {
     (void)cd;
-    if (objc != 1) {
-        Tcl_WrongNumArgs(interp, 1, objv, NULL);
-        Tcl_SetErrorCode(interp, "TDB", "STOP", "USAGE", NULL);
+    TdbJsonWriter w;
+    if (objc < 2 || (objc % 2) != 0) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?-depth n? ?-maxBytes n? ?-channel chan? ?-schema schema? value");
+        Tcl_SetErrorCode(interp, "TDB", "JSON", "USAGE", NULL);
         return TCL_ERROR;
     }
-    TdbState *state = TdbGetState(interp);
-    state->started = 0;
-    state->isPaused = 0;
-    /* clear breakpoints and pause state */
-    TdbBreakpointClearAll(state);
-    if (state->lastStopDict) { Tcl_DecrRefCount(state->lastStopDict); state->lastStopDict = NULL; }
-    Tcl_UnsetVar(interp, TDB_GLOBAL_VAR_RESUME, TCL_GLOBAL_ONLY);
-    /* Reset counters on stop as well */
-    state->traceHits = 0;
-    state->frameLookups = 0;
-    state->procFastRejects = 0;
-    state->fileFastRejects = 0;
-    Tdb_RecomputeTracing(interp);
-    Tcl_ResetResult(interp);
-    return TCL_OK;
+    if (TdbJsonOptions(interp, objc - 1, objv, 1, &w) != TCL_OK) return TCL_ERROR;
+    return TdbJsonFinish(interp, &w, objv[objc-1]);
 }
 
+/* tdb::event ?-format dict|json? ?json options? -- the last stop event */
 static int
-TdbBreakAddCmd(TdbState *state, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+TdbEventCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
 {
-    if (objc < 4) {
-        Tcl_WrongNumArgs(interp, 2, objv, "-file|-proc|-method ...");
-        Tcl_SetErrorCode(interp, "TDB", "BREAK", "USAGE", NULL);
+    (void)cd;
+    static const char *const formats[] = { "dict", "json", NULL };
+    int fmt = 0, first = 1;
+    TdbJsonWriter w;
+    if (objc >= 3 && strcmp(Tcl_GetString(objv[1]), "-format") == 0) {
+        if (Tcl_GetIndexFromObj(interp, objv[2], formats, "format", 0, &fmt) != TCL_OK) {
+            Tcl_SetErrorCode(interp, "TDB", "EVENT", "FORMAT", NULL);
+            return TCL_ERROR;
+        }
+        first = 3;
+    }
+    if (((objc - first) % 2) != 0 || (fmt == 0 && objc > first)) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?-format dict|json? ?-depth n? ?-maxBytes n? ?-channel chan?");
+        Tcl_SetErrorCode(interp, "TDB", "EVENT", "USAGE", NULL);
         return TCL_ERROR;
     }
-    TdbBreakpointType type = TDB_BP_NONE;
-    Tcl_Obj *fileObj = NULL, *procName = NULL, *methodPattern = NULL, *methodName = NULL;
-    Tcl_Obj *condition = NULL, *hitCount = NULL, *logMessage = NULL;
-    int line = -1;
-    int oneshot = 0;
-    for (int i=2;i<objc;i++) {
-        const char *opt = Tcl_GetString(objv[i]);
-        if (strcmp(opt, "-file") == 0) {
-            if (++i >= objc) return TdbError(interp, "BREAK", "USAGE", "missing value for -file");
-            if (type != TDB_BP_NONE && type != TDB_BP_FILE) return TdbError(interp, "BREAK", "TARGET", "conflicting breakpoint target options");
-            type = TDB_BP_FILE; fileObj = objv[i];
-        } else if (strcmp(opt, "-line") == 0) {
-            if (++i >= objc) return TdbError(interp, "BREAK", "USAGE", "missing value for -line");
-            if (Tcl_GetIntFromObj(interp, objv[i], &line) != TCL_OK) { Tcl_SetErrorCode(interp, "TDB","BREAK","VALUE",NULL); return TCL_ERROR; }
-        } else if (strcmp(opt, "-proc") == 0) {
-            if (++i >= objc) return TdbError(interp, "BREAK", "USAGE", "missing value for -proc");
-            if (type != TDB_BP_NONE) return TdbError(interp, "BREAK", "TARGET", "conflicting breakpoint target options");
-            type = TDB_BP_PROC; procName = objv[i];
-        } else if (strcmp(opt, "-method") == 0) {
-            if (i+2 >= objc) return TdbError(interp, "BREAK", "USAGE", "missing values for -method");
-            if (type != TDB_BP_NONE) return TdbError(interp, "BREAK", "TARGET", "conflicting breakpoint target options");
-            type = TDB_BP_METHOD; methodPattern = objv[++i]; methodName = objv[++i];
-        } else if (strcmp(opt, "-condition") == 0) {
-            if (++i >= objc) return TdbError(interp, "BREAK", "USAGE", "missing value for -condition");
-            condition = objv[i];
-        } else if (strcmp(opt, "-hitCount") == 0) {
-            if (++i >= objc) return TdbError(interp, "BREAK", "USAGE", "missing value for -hitCount");
-            hitCount = objv[i];
-        } else if (strcmp(opt, "-oneshot") == 0) {
-            if (++i >= objc) return TdbError(interp, "BREAK", "USAGE", "missing value for -oneshot");
-            if (Tcl_GetBooleanFromObj(interp, objv[i], &oneshot) != TCL_OK) { Tcl_SetErrorCode(interp, "TDB","BREAK","VALUE",NULL); return TCL_ERROR; }
-        } else if (strcmp(opt, "-log") == 0) {
-            if (++i >= objc) return TdbError(interp, "BREAK", "USAGE", "missing value for -log");
-            logMessage = objv[i];
-        } else {
-            return TdbError(interp, "BREAK", "OPTION", "unknown breakpoint option");
-        }
+    Tcl_Obj *ev = Tcl_GetVar2Ex(interp, TDB_GLOBAL_VAR_LAST_STOP, NULL, TCL_GLOBAL_ONLY);
+    if (ev == NULL) return TdbError(interp, "NOPAUSE", NULL, "no pause recorded");
+    if (fmt == 0) {
+        Tcl_SetObjResult(interp, ev);
+        return TCL_OK;
     }
-    if (type == TDB_BP_NONE) return TdbError(interp, "BREAK","TARGET","no breakpoint target specified");
-    if (type == TDB_BP_FILE && (!fileObj || line < 0)) return TdbError(interp, "BREAK","TARGET","file breakpoints require -file and -line");
-    if (type == TDB_BP_PROC && !procName) return TdbError(interp, "BREAK","TARGET","proc breakpoints require -proc");
-    if (type == TDB_BP_METHOD && (!methodPattern || !methodName)) return TdbError(interp, "BREAK","TARGET","method breakpoints require -method pattern name");
-
-    TdbBreakpoint *bp = (TdbBreakpoint *)ckalloc(sizeof(TdbBreakpoint));
-    memset(bp, 0, sizeof(TdbBreakpoint));
-    bp->type = type; bp->id = state->nextBreakpointId++; bp->line = line;
-    if (fileObj) { bp->filePath = TdbMaybeNormalizePath(state, fileObj); }
-    if (procName) { bp->procName = procName; Tcl_IncrRefCount(bp->procName); }
-    if (methodPattern) { bp->methodPattern = methodPattern; Tcl_IncrRefCount(bp->methodPattern); }
-    if (methodName) { bp->methodName = methodName; Tcl_IncrRefCount(bp->methodName); }
-    if (condition) { bp->condition = condition; Tcl_IncrRefCount(bp->condition); }
-    if (hitCount) { bp->hitCountSpec = hitCount; Tcl_IncrRefCount(bp->hitCountSpec); }
-    if (logMessage) { bp->logMessage = logMessage; Tcl_IncrRefCount(bp->logMessage); }
-    bp->oneshot = oneshot ? 1 : 0;
-    bp->hits = 0;
+    if (TdbJsonOptions(interp, objc, objv, first, &w) != TCL_OK) return TCL_ERROR;
+    if (w.schema == NULL) w.schema = TDB_LIT(TdbGetState(interp), JSON_EVENT);
+    Tcl_IncrRefCount(ev);
+    int rc = TdbJsonFinish(interp, &w, ev);
+    Tcl_DecrRefCount(ev);
+    return rc;
+}
 
-    int isNew = 0;
-    Tcl_HashEntry *entry = Tcl_CreateHashEntry(&state->breakpoints, (const void*)(intptr_t)bp->id, &isNew);
-    Tcl_SetHashValue(entry, bp);
-    TdbAdjustCounts(state, type, +1);
-    Tdb_RecomputeTracing(interp);
+/* ----------------------------------------------------------------------
+ * Stack frames (tdb::frames)
+ *
+ * Walks [info frame d] from the paused level down to 1 in one C pass.
+ * Without paging options the result is the historical list of at most
+ * TDB_FRAMES_LEGACY frames; with -start, -count or -fields it is
+ * {total n frames {...}} so a client can page through deep stacks.
+ * ---------------------------------------------------------------------- */
 
-    Tcl_SetObjResult(interp, Tcl_NewIntObj(bp->id));
-    return TCL_OK;
-}
+#define TDB_FRAMES_LEGACY 20
 
+/* tdb::frames ?-start n? ?-count n? ?-fields list? ?-format dict|json? ?json options? */
 static int
-TdbBreakRmCmd(TdbState *state, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+TdbFramesCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
 {
-    if (objc != 3) { Tcl_WrongNumArgs(interp, 2, objv, "id"); Tcl_SetErrorCode(interp, "TDB","BREAK","USAGE",NULL); return TCL_ERROR; }
-    int id = 0; if (Tcl_GetIntFromObj(interp, objv[2], &id) != TCL_OK) { Tcl_SetErrorCode(interp, "TDB","BREAK","VALUE",NULL); return TCL_ERROR; }
-    Tcl_HashEntry *entry = Tcl_FindHashEntry(&state->breakpoints, (const void*)(intptr_t)id);
-    if (!entry) return TdbError(interp, "BREAK","UNKNOWN","breakpoint id not found");
-    TdbRemoveBreakpointEntry(state, entry);
-    Tdb_RecomputeTracing(interp);
-    Tcl_SetObjResult(interp, Tcl_NewIntObj(id));
-    return TCL_OK;
+    (void)cd;
+    static const char *const formats[] = { "dict", "json", NULL };
+    TdbState *state = TdbGetState(interp);
+    int start = 0, count = TDB_FRAMES_LEGACY, countSet = 0, fmt = 0, paged = 0, nJson = 0;
+    int nFields = 0;
+    Tcl_Obj **fieldv = NULL;
+    Tcl_Obj *jsonv[6];
+    TdbJsonWriter w;
+
+    if ((objc - 1) % 2 != 0) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?-start n? ?-count n? ?-fields list? ?-format dict|json? ?-depth n? ?-maxBytes n? ?-channel chan?");
+        Tcl_SetErrorCode(interp, "TDB", "FRAMES", "USAGE", NULL);
+        return TCL_ERROR;
+    }
+    for (int i = 1; i < objc; i += 2) {
+        const char *opt = Tcl_GetString(objv[i]);
+        if (strcmp(opt, "-start") == 0 || strcmp(opt, "-count") == 0) {
+            int v;
+            if (Tcl_GetIntFromObj(NULL, objv[i+1], &v) != TCL_OK || v < 0) {
+                return TdbError(interp, "FRAMES", "VALUE", "-start and -count must be integers >= 0");
+            }
+            if (opt[1] == 's') start = v; else { count = v; countSet = 1; }
+            paged = 1;
+        } else if (strcmp(opt, "-fields") == 0) {
+            if (Tcl_ListObjGetElements(NULL, objv[i+1], &nFields, &fieldv) != TCL_OK) {
+                return TdbError(interp, "FRAMES", "VALUE", "-fields must be a list");
+            }
+            paged = 1;
+        } else if (strcmp(opt, "-format") == 0) {
+            if (Tcl_GetIndexFromObj(interp, objv[i+1], formats, "format", 0, &fmt) != TCL_OK) {
+                Tcl_SetErrorCode(interp, "TDB", "FRAMES", "FORMAT", NULL);
+                return TCL_ERROR;
+            }
+        } else if (nJson < 6) {
+            jsonv[nJson++] = objv[i];
+            jsonv[nJson++] = objv[i+1];
+        } else {
+            return TdbError(interp, "FRAMES", "USAGE", "too many options");
+        }
+    }
+    if (fmt == 0 && nJson > 0) return TdbError(interp, "FRAMES", "USAGE", "JSON options need -format json");
+    /* Paging walks the whole stack unless -count says otherwise */
+    if (paged && !countSet) count = 0;
+    if (fmt == 1 && TdbJsonOptions(interp, nJson, jsonv, 0, &w) != TCL_OK) return TCL_ERROR;
+    if (fmt == 1 && w.schema == NULL) w.schema = paged ? TDB_LIT(state, JSON_PAGE) : TDB_LIT(state, JSON_FRAMES);
+
+    Tcl_Obj *frames = Tcl_NewListObj(0, NULL);
+    Tcl_IncrRefCount(frames);
+    int total = 0, n = 0;
+    Tcl_Obj *last = Tcl_GetVar2Ex(interp, TDB_GLOBAL_VAR_LAST_STOP, NULL, TCL_GLOBAL_ONLY);
+    Tcl_Obj *levelObj = NULL;
+    int stopSize = 0;
+    if (last && Tcl_DictObjSize(NULL, last, &stopSize) == TCL_OK && stopSize > 0) {
+        /* [info frame] counts this command too; frames above it are gone.
+         * A stop published through ::tdb::_last_stop alone is located now
+         * from its level. */
+        int abs = -1;
+        if (Tcl_DictObjGet(NULL, last, TDB_LIT(state, LEVEL), &levelObj) != TCL_OK || levelObj == NULL ||
+            Tcl_GetIntFromObj(NULL, levelObj, &abs) != TCL_OK) {
+            abs = -1;
+        }
+        int depth = TdbInfoInt(state, interp, TDB_LIT(state, FRAME));
+        int stopFrame = (last == state->lastStopDict) ? state->stopFrame : 0;
+        if (stopFrame <= 0) {
+            /* The paused command has returned; keep the one that ran it */
+            stopFrame = TdbStopFrameAt(state, interp, abs, depth - 1);
+            if (stopFrame > 0) stopFrame++;
+        }
+        if (stopFrame <= 0 || stopFrame > depth) stopFrame = depth;
+        total = stopFrame - 1;
+        if (total < 0) total = 0;
+        for (int d = total - start; d >= 1 && (count == 0 || n < count); d--) {
+            /* Evaluated in the caller's frame so `level` is reported as the script would see it */
+            Tcl_Obj *words[3];
+            words[0] = TDB_LIT(state, INFO);
+            words[1] = TDB_LIT(state, FRAME);
+            words[2] = Tcl_NewIntObj(d);
+            Tcl_IncrRefCount(words[2]);
+            int frc = Tcl_EvalObjv(interp, 3, words, TCL_EVAL_DIRECT);
+            Tcl_DecrRefCount(words[2]);
+            if (frc != TCL_OK) break;
+            Tcl_Obj *fr = Tcl_GetObjResult(interp);
+            Tcl_IncrRefCount(fr);
+            Tcl_Obj *entry;
+            int size = 0;
+            if (nFields > 0) {
+                entry = Tcl_NewDictObj();
+                for (int f = 0; f < nFields; f++) {
+                    Tcl_Obj *value = NULL;
+                    if (Tcl_DictObjGet(NULL, fr, fieldv[f], &value) == TCL_OK && value) {
+                        Tcl_DictObjPut(NULL, entry, fieldv[f], value);
+                    }
+                }
+            } else {
+                /* info frame returns a plain list; keep frames as dicts for tdb::json */
+                (void)Tcl_DictObjSize(NULL, fr, &size);
+                entry = fr;
+            }
+            Tcl_ListObjAppendElement(NULL, frames, entry);
+            Tcl_DecrRefCount(fr);
+            n++;
+        }
+    }
+    Tcl_ResetResult(interp);
+
+    Tcl_Obj *result = frames;
+    if (paged) {
+        result = Tcl_NewDictObj();
+        Tcl_DictObjPut(NULL, result, TDB_LIT(state, TOTAL), Tcl_NewIntObj(total));
+        Tcl_DictObjPut(NULL, result, TDB_LIT(state, FRAMES), frames);
+    }
+    Tcl_IncrRefCount(result);
+    int rc = TCL_OK;
+    if (fmt == 0) {
+        Tcl_SetObjResult(interp, result);
+    } else {
+        rc = TdbJsonFinish(interp, &w, result);
+    }
+    Tcl_DecrRefCount(result);
+    Tcl_DecrRefCount(frames);
+    return rc;
 }
 
 static int
-TdbBreakClearCmd(TdbState *state, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+CompareCoverageFiles(const void *a, const void *b)
 {
-    if (objc != 2) { Tcl_WrongNumArgs(interp, 2, objv, NULL); Tcl_SetErrorCode(interp, "TDB","BREAK","USAGE",NULL); return TCL_ERROR; }
-    TdbBreakpointClearAll(state);
-    Tdb_RecomputeTracing(interp);
-    Tcl_ResetResult(interp);
-    return TCL_OK;
+    const TdbCoverageFile *fa = *(TdbCoverageFile *const *)a, *fb = *(TdbCoverageFile *const *)b;
+    return strcmp(Tcl_GetString(fa->path), Tcl_GetString(fb->path));
 }
 
-static int CompareInts(const void *a, const void *b) { int ia=*(const int*)a, ib=*(const int*)b; return ia<ib?-1:ia>ib?1:0; }
-
+/* tdb::coverage report ?-format dict|lcov|json? */
 static int
-TdbBreakListCmd(TdbState *state, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+TdbCoverageReportCmd(TdbState *state, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
 {
-    if (objc != 2) { Tcl_WrongNumArgs(interp, 2, objv, NULL); Tcl_SetErrorCode(interp, "TDB","BREAK","USAGE",NULL); return TCL_ERROR; }
-    Tcl_Obj *list = Tcl_NewListObj(0, NULL);
-    Tcl_HashSearch search; Tcl_HashEntry *entry = Tcl_FirstHashEntry(&state->breakpoints, &search);
-    int count = 0; while (entry) { count++; entry = Tcl_NextHashEntry(&search); }
-    if (count == 0) { Tcl_SetObjResult(interp, list); return TCL_OK; }
-    int *ids = (int*)ckalloc(sizeof(int)*count); int idx=0; entry = Tcl_FirstHashEntry(&state->breakpoints, &search);
-    while (entry) { ids[idx++] = (int)(intptr_t)Tcl_GetHashKey(&state->breakpoints, entry); entry = Tcl_NextHashEntry(&search); }
-    qsort(ids, count, sizeof(int), CompareInts);
-    for (int i=0;i<count;i++) {
-        entry = Tcl_FindHashEntry(&state->breakpoints, (const void*)(intptr_t)ids[i]);
-        if (!entry) continue; TdbBreakpoint *bp = (TdbBreakpoint*)Tcl_GetHashValue(entry);
-        Tcl_ListObjAppendElement(interp, list, TdbBreakpointToDict(interp, bp));
+    static const char *const formats[] = { "dict", "lcov", "json", NULL };
+    enum { FMT_DICT, FMT_LCOV, FMT_JSON };
+    int fmt = FMT_DICT;
+    if (objc != 2 && objc != 4) {
+        Tcl_WrongNumArgs(interp, 2, objv, "?-format dict|lcov|json?");
+        Tcl_SetErrorCode(interp, "TDB", "COVERAGE", "USAGE", NULL);
+        return TCL_ERROR;
     }
-    ckfree(ids);
-    Tcl_SetObjResult(interp, list);
+    if (objc == 4) {
+        if (strcmp(Tcl_GetString(objv[2]), "-format") != 0) return TdbError(interp, "COVERAGE", "OPTION", "unknown option");
+        if (Tcl_GetIndexFromObj(interp, objv[3], formats, "format", 0, &fmt) != TCL_OK) {
+            Tcl_SetErrorCode(interp, "TDB", "COVERAGE", "FORMAT", NULL);
+            return TCL_ERROR;
+        }
+    }
+    int n = 0, k = 0;
+    TdbCoverageFile **files = (TdbCoverageFile **)ckalloc((state->coverageFiles.numEntries + 1) * sizeof(TdbCoverageFile *));
+    Tcl_HashSearch search;
+    for (Tcl_HashEntry *entry = Tcl_FirstHashEntry(&state->coverageFiles, &search); entry; entry = Tcl_NextHashEntry(&search)) {
+        /* Files outside -files are still indexed, but never reported */
+        TdbCoverageFile *cf = (TdbCoverageFile *)Tcl_GetHashValue(entry);
+        if (!cf->excluded) files[n++] = cf;
+    }
+    qsort(files, n, sizeof(TdbCoverageFile *), CompareCoverageFiles);
+    Tcl_Obj *out = fmt == FMT_DICT ? Tcl_NewDictObj() : Tcl_NewObj();
+    if (fmt == FMT_JSON) Tcl_AppendToObj(out, "{", 1);
+    for (k = 0; k < n; k++) {
+        int found = 0, hit = 0, len = 0;
+        Tcl_Obj **pairs = NULL;
+        Tcl_Obj *lines = TdbCoverageLines(files[k], &found, &hit);
+        const char *path = Tcl_GetString(files[k]->path);
+        Tcl_IncrRefCount(lines);
+        Tcl_ListObjGetElements(NULL, lines, &len, &pairs);
+        if (fmt == FMT_DICT) {
+            Tcl_DictObjPut(NULL, out, files[k]->path, lines);
+        } else if (fmt == FMT_LCOV) {
+            Tcl_AppendStringsToObj(out, "TN:\nSF:", path, "\n", NULL);
+            for (int i = 0; i + 1 < len; i += 2) {
+                Tcl_AppendStringsToObj(out, "DA:", Tcl_GetString(pairs[i]), ",", Tcl_GetString(pairs[i+1]), "\n", NULL);
+            }
+            char buf[64];
+            snprintf(buf, sizeof(buf), "LF:%d\nLH:%d\nend_of_record\n", found, hit);
+            Tcl_AppendToObj(out, buf, -1);
+        } else {
+            if (k > 0) Tcl_AppendToObj(out, ",", 1);
+            TdbJsonAppendString(out, path, (int)strlen(path));
+            Tcl_AppendToObj(out, ":{\"lines\":{", -1);
+            for (int i = 0; i + 1 < len; i += 2) {
+                Tcl_AppendStringsToObj(out, i ? ",\"" : "\"", Tcl_GetString(pairs[i]), "\":", Tcl_GetString(pairs[i+1]), NULL);
+            }
+            char buf[64];
+            snprintf(buf, sizeof(buf), "},\"found\":%d,\"hit\":%d}", found, hit);
+            Tcl_AppendToObj(out, buf, -1);
+        }
+        Tcl_DecrRefCount(lines);
+    }
+    if (fmt == FMT_JSON) Tcl_AppendToObj(out, "}", 1);
+    ckfree(files);
+    Tcl_SetObjResult(interp, out);
     return TCL_OK;
 }
 
 static int
-TdbBreakCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+TdbCoverageCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
 {
-    (void)cd; TdbState *state = TdbGetState(interp);
-    if (objc < 2) { Tcl_WrongNumArgs(interp, 1, objv, "add|rm|clear|ls ..."); Tcl_SetErrorCode(interp, "TDB","BREAK","USAGE",NULL); return TCL_ERROR; }
+    (void)cd;
+    if (objc < 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "start|stop|report|clear ?args?");
+        Tcl_SetErrorCode(interp, "TDB", "COVERAGE", "USAGE", NULL);
+        return TCL_ERROR;
+    }
+    TdbState *state = TdbGetState(interp);
     const char *sub = Tcl_GetString(objv[1]);
-    if (strcmp(sub,"add")==0) return TdbBreakAddCmd(state, interp, objc, objv);
-    if (strcmp(sub,"rm")==0) return TdbBreakRmCmd(state, interp, objc, objv);
-    if (strcmp(sub,"clear")==0) return TdbBreakClearCmd(state, interp, objc, objv);
-    if (strcmp(sub,"ls")==0) return TdbBreakListCmd(state, interp, objc, objv);
-    return TdbError(interp, "BREAK","SUBCOMMAND","unknown breakpoint subcommand");
+    if (strcmp(sub, "start") == 0) {
+        Tcl_Obj *pattern = NULL;
+        if (objc == 4 && strcmp(Tcl_GetString(objv[2]), "-files") == 0) {
+            pattern = objv[3];
+        } else if (objc != 2) {
+            Tcl_WrongNumArgs(interp, 2, objv, "?-files pattern?");
+            Tcl_SetErrorCode(interp, "TDB", "COVERAGE", "USAGE", NULL);
+            return TCL_ERROR;
+        }
+        if (pattern) Tcl_IncrRefCount(pattern);
+        if (state->coveragePattern) Tcl_DecrRefCount(state->coveragePattern);
+        state->coveragePattern = pattern;
+        state->coverageActive = 1;
+        Tcl_HashSearch search;
+        for (Tcl_HashEntry *entry = Tcl_FirstHashEntry(&state->coverageFiles, &search); entry; entry = Tcl_NextHashEntry(&search)) {
+            TdbCoverageFilter(state, (TdbCoverageFile *)Tcl_GetHashValue(entry));
+        }
+        /* Places skipped as excluded may be included now */
+        for (Tcl_HashEntry *entry = Tcl_FirstHashEntry(&state->coverageSites, &search); entry; entry = Tcl_NextHashEntry(&search)) {
+            ((TdbCoverageSite *)Tcl_GetHashValue(entry))->done = 0;
+        }
+    } else if (strcmp(sub, "stop") == 0) {
+        if (objc != 2) { Tcl_WrongNumArgs(interp, 2, objv, NULL); Tcl_SetErrorCode(interp, "TDB", "COVERAGE", "USAGE", NULL); return TCL_ERROR; }
+        state->coverageActive = 0;
+    } else if (strcmp(sub, "clear") == 0) {
+        if (objc != 2) { Tcl_WrongNumArgs(interp, 2, objv, NULL); Tcl_SetErrorCode(interp, "TDB", "COVERAGE", "USAGE", NULL); return TCL_ERROR; }
+        TdbCoverageReset(state);
+        Tcl_ResetResult(interp);
+        return TCL_OK;
+    } else if (strcmp(sub, "report") == 0) {
+        return TdbCoverageReportCmd(state, interp, objc, objv);
+    } else {
+        return TdbError(interp, "COVERAGE", "SUBCOMMAND", "unknown coverage subcommand");
+    }
+    Tdb_RecomputeTracing(interp);
+    Tcl_ResetResult(interp);
+    return TCL_OK;
 }
 
 static int
@@ -875,82 +4061,85 @@ TdbPauseNowCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[
         reason = Tcl_GetString(objv[2]);
     }
     /* Start event with current frame info when available */
-    Tcl_Obj *event = NULL;
-    {
-        Tcl_Obj *argv0[3];
-        argv0[0] = Tcl_NewStringObj("info", -1);
-        argv0[1] = Tcl_NewStringObj("frame", -1);
-        argv0[2] = Tcl_NewStringObj("-1", -1);
-        for (int i=0;i<3;i++) Tcl_IncrRefCount(argv0[i]);
-        if (Tcl_EvalObjv(interp, 3, argv0, TCL_EVAL_GLOBAL|TCL_EVAL_DIRECT) == TCL_OK) {
-            event = Tcl_GetObjResult(interp);
-            Tcl_IncrRefCount(event);
-        }
-        for (int i=0;i<3;i++) Tcl_DecrRefCount(argv0[i]);
-        Tcl_ResetResult(interp);
-    }
+    TdbState *state = TdbGetState(interp);
+    Tcl_Obj *event = TdbInfoFrame(state, interp, TDB_LIT(state, MINUS1));
+    Tcl_ResetResult(interp);
     if (event == NULL) {
         event = Tcl_NewDictObj();
         Tcl_IncrRefCount(event);
-        Tcl_DictObjPut(interp, event, Tcl_NewStringObj("file", -1), Tcl_NewStringObj("", -1));
-        Tcl_DictObjPut(interp, event, Tcl_NewStringObj("line", -1), Tcl_NewIntObj(-1));
-        Tcl_DictObjPut(interp, event, Tcl_NewStringObj("type", -1), Tcl_NewStringObj("eval", -1));
-        Tcl_DictObjPut(interp, event, Tcl_NewStringObj("proc", -1), Tcl_NewStringObj("", -1));
-        Tcl_DictObjPut(interp, event, Tcl_NewStringObj("cmd", -1), Tcl_NewListObj(0, NULL));
-        Tcl_DictObjPut(interp, event, Tcl_NewStringObj("level", -1), Tcl_NewIntObj(0));
+        Tcl_DictObjPut(NULL, event, TDB_LIT(state, FILE), Tcl_NewObj());
+        Tcl_DictObjPut(NULL, event, TDB_LIT(state, LINE), Tcl_NewIntObj(-1));
+        Tcl_DictObjPut(NULL, event, TDB_LIT(state, TYPE), TDB_LIT(state, EVAL));
+        Tcl_DictObjPut(NULL, event, TDB_LIT(state, PROC), Tcl_NewObj());
+        Tcl_DictObjPut(NULL, event, TDB_LIT(state, CMD), Tcl_NewListObj(0, NULL));
+        Tcl_DictObjPut(NULL, event, TDB_LIT(state, LEVEL), Tcl_NewIntObj(0));
+    } else if (Tcl_IsShared(event)) {
+        Tcl_Obj *copy = Tcl_DuplicateObj(event);
+        Tcl_IncrRefCount(copy);
+        Tcl_DecrRefCount(event);
+        event = copy;
     }
     /* Ensure 'level' is present; some Tcl builds omit it from info frame */
     {
         Tcl_Obj *lvlObj = NULL;
-        int haveLevel = (Tcl_DictObjGet(interp, event, Tcl_NewStringObj("level", -1), &lvlObj) == TCL_OK) && (lvlObj != NULL);
+        int haveLevel = (Tcl_DictObjGet(NULL, event, TDB_LIT(state, LEVEL), &lvlObj) == TCL_OK) && (lvlObj != NULL);
         if (!haveLevel) {
             /* Fallback to info level */
             int lvl = 0;
-            Tcl_Obj *ilv = Tcl_NewStringObj("info level", -1); Tcl_IncrRefCount(ilv);
-            if (Tcl_EvalObjEx(interp, ilv, TCL_EVAL_DIRECT) == TCL_OK) {
-                Tcl_Obj *res = Tcl_GetObjResult(interp);
-                Tcl_GetIntFromObj(interp, res, &lvl);
+            Tcl_Obj *il[2];
+            il[0] = TDB_LIT(state, INFO); il[1] = TDB_LIT(state, LEVEL);
+            if (Tcl_EvalObjv(interp, 2, il, TCL_EVAL_DIRECT) == TCL_OK) {
+                Tcl_GetIntFromObj(NULL, Tcl_GetObjResult(interp), &lvl);
             }
-            Tcl_DecrRefCount(ilv);
             Tcl_ResetResult(interp);
-            Tcl_DictObjPut(interp, event, Tcl_NewStringObj("level", -1), Tcl_NewIntObj(lvl));
+            Tcl_DictObjPut(NULL, event, TDB_LIT(state, LEVEL), Tcl_NewIntObj(lvl));
         }
     }
-    Tcl_DictObjPut(interp, event, Tcl_NewStringObj("event", -1), Tcl_NewStringObj("stopped", -1));
-    Tcl_DictObjPut(interp, event, Tcl_NewStringObj("reason", -1), Tcl_NewStringObj(reason, -1));
+    Tcl_DictObjPut(NULL, event, TDB_LIT(state, EVENT), TDB_LIT(state, STOPPED));
+    Tcl_DictObjPut(NULL, event, TDB_LIT(state, REASON), Tcl_NewStringObj(reason, -1));
 
+    /* Name the proc whose variables are captured when info frame did not */
+    {
+        Tcl_Obj *procName = NULL;
+        if (Tcl_DictObjGet(NULL, event, TDB_LIT(state, PROC), &procName) != TCL_OK || procName == NULL) {
+            Tcl_Obj *il[3];
+            il[0] = TDB_LIT(state, INFO); il[1] = TDB_LIT(state, LEVEL); il[2] = TDB_LIT(state, ZERO);
+            if (Tcl_EvalObjv(interp, 3, il, TCL_EVAL_DIRECT) == TCL_OK) {
+                Tcl_Obj *word = NULL;
+                if (Tcl_ListObjIndex(NULL, Tcl_GetObjResult(interp), 0, &word) == TCL_OK && word) {
+                    Tcl_DictObjPut(NULL, event, TDB_LIT(state, PROC), word);
+                }
+            }
+            Tcl_ResetResult(interp);
+        }
+    }
     /* Build locals snapshot: locals + args (if proc present) */
     Tcl_Obj *localsDict = Tcl_NewDictObj();
     Tcl_IncrRefCount(localsDict);
     {
         /* info locals (evaluate in current frame) */
-        Tcl_Obj *il[2]; il[0] = Tcl_NewStringObj("info", -1); il[1] = Tcl_NewStringObj("locals", -1);
-        Tcl_IncrRefCount(il[0]); Tcl_IncrRefCount(il[1]);
+        Tcl_Obj *il[2];
+        il[0] = TDB_LIT(state, INFO); il[1] = TDB_LIT(state, LOCALS);
         if (Tcl_EvalObjv(interp, 2, il, TCL_EVAL_DIRECT) == TCL_OK) {
             Tcl_Obj *list = Tcl_GetObjResult(interp);
             int len = 0; Tcl_ListObjLength(interp, list, &len);
             for (int i=0;i<len;i++) {
                 Tcl_Obj *nameObj = NULL; Tcl_ListObjIndex(interp, list, i, &nameObj);
                 if (!nameObj) continue;
-                Tcl_Obj *val = Tcl_GetVar2Ex(interp, Tcl_GetString(nameObj), NULL, 0);
-                if (!val) val = Tcl_NewStringObj("", -1);
-                Tcl_IncrRefCount(val);
-                Tcl_DictObjPut(interp, localsDict, nameObj, val);
-                Tcl_DecrRefCount(val);
+                Tcl_Obj *val = Tcl_ObjGetVar2(interp, nameObj, NULL, 0);
+                Tcl_DictObjPut(NULL, localsDict, nameObj, val ? val : Tcl_NewObj());
             }
         }
-        Tcl_DecrRefCount(il[0]); Tcl_DecrRefCount(il[1]);
         Tcl_ResetResult(interp);
     }
     /* If we know proc name, include its args */
     {
         Tcl_Obj *procName = NULL;
-        if (Tcl_DictObjGet(interp, event, Tcl_NewStringObj("proc", -1), &procName) == TCL_OK && procName && Tcl_GetCharLength(procName) > 0) {
+        if (Tcl_DictObjGet(NULL, event, TDB_LIT(state, PROC), &procName) == TCL_OK && procName && Tcl_GetCharLength(procName) > 0) {
             Tcl_Obj *ia[3];
-            ia[0] = Tcl_NewStringObj("info", -1);
-            ia[1] = Tcl_NewStringObj("args", -1);
+            ia[0] = TDB_LIT(state, INFO);
+            ia[1] = TDB_LIT(state, ARGS);
             ia[2] = procName; Tcl_IncrRefCount(ia[2]);
-            Tcl_IncrRefCount(ia[0]); Tcl_IncrRefCount(ia[1]);
             if (Tcl_EvalObjv(interp, 3, ia, TCL_EVAL_DIRECT) == TCL_OK) {
                 Tcl_Obj *alist = Tcl_GetObjResult(interp);
                 int alen = 0; Tcl_ListObjLength(interp, alist, &alen);
@@ -959,32 +4148,363 @@ TdbPauseNowCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[
                     if (!an) continue;
                     /* don't overwrite if already set as local */
                     Tcl_Obj *dummy = NULL;
-                    if (Tcl_DictObjGet(interp, localsDict, an, &dummy) != TCL_OK || dummy == NULL) {
-                        Tcl_Obj *vv = Tcl_GetVar2Ex(interp, Tcl_GetString(an), NULL, 0);
-                        if (!vv) vv = Tcl_NewStringObj("", -1);
-                        Tcl_IncrRefCount(vv);
-                        Tcl_DictObjPut(interp, localsDict, an, vv);
-                        Tcl_DecrRefCount(vv);
+                    if (Tcl_DictObjGet(NULL, localsDict, an, &dummy) != TCL_OK || dummy == NULL) {
+                        Tcl_Obj *vv = Tcl_ObjGetVar2(interp, an, NULL, 0);
+                        Tcl_DictObjPut(NULL, localsDict, an, vv ? vv : Tcl_NewObj());
                     }
                 }
             }
-            Tcl_DecrRefCount(ia[0]); Tcl_DecrRefCount(ia[1]); Tcl_DecrRefCount(ia[2]);
+            Tcl_DecrRefCount(ia[2]);
             Tcl_ResetResult(interp);
         }
     }
-    Tcl_DictObjPut(interp, event, Tcl_NewStringObj("locals", -1), localsDict);
+    Tcl_DictObjPut(NULL, event, TDB_LIT(state, LOCALS), localsDict);
     Tcl_DecrRefCount(localsDict);
-    Tdb_SetStopEvent(interp, event);
+    /* The locals come from the caller's frame: [info level] deep */
+    int frameLevel = -1;
+    {
+        Tcl_Obj *il[2];
+        il[0] = TDB_LIT(state, INFO); il[1] = TDB_LIT(state, LEVEL);
+        if (Tcl_EvalObjv(interp, 2, il, TCL_EVAL_DIRECT) == TCL_OK) {
+            Tcl_GetIntFromObj(NULL, Tcl_GetObjResult(interp), &frameLevel);
+        }
+        Tcl_ResetResult(interp);
+    }
+    /* No script runs in between: the paused command is the caller's current one */
+    Tdb_SetStopEvent(interp, event, frameLevel, TdbInfoInt(state, interp, TDB_LIT(state, FRAME)));
     /* Non-blocking test hook: publish event only. */
     Tcl_SetObjResult(interp, Tcl_NewStringObj("ok", -1));
     Tcl_DecrRefCount(event);
     return TCL_OK;
 }
 
+/* ----------------------------------------------------------------------
+ * Memory footprint (tdb::memory)
+ *
+ * Estimates the bytes each variable retains by walking the internal reps
+ * of its value: string and bytearray payloads, list elements, and dict
+ * keys and values. Objects are counted once per report (the first
+ * variable that reaches a shared object is charged for it), and walking
+ * never shimmers a value. Allocator overhead and spare list capacity are
+ * not visible through the public API, so sizes are lower-bound estimates.
+ * Values are read through the public variable API, so read traces on the
+ * variables (and on array elements) run as they would for [set]. Names
+ * that are declared but hold no value are counted as undefined.
+ * ---------------------------------------------------------------------- */
+
+#define TDB_MEM_DEPTH 1000            /* deeper values count only their Tcl_Obj */
+#define TDB_MEM_TOP 10
+#define TDB_MEM_VAR ((Tcl_WideInt)(sizeof(Tcl_HashEntry) + 2 * sizeof(void *)))
+
+static const Tcl_ObjType *tdbByteArrayType, *tdbStringType;
+
+typedef struct {
+    Tcl_Obj *name;
+    Tcl_WideInt size;
+    int isArray;
+    int elements;
+} TdbMemVar;
+
+static Tcl_WideInt
+TdbMemSize(Tcl_HashTable *seen, Tcl_Obj *obj, int depth)
+{
+    int isNew;
+    Tcl_CreateHashEntry(seen, (const char *)obj, &isNew);
+    if (!isNew) return 0;
+    Tcl_WideInt size = sizeof(Tcl_Obj);
+    if (obj->bytes) size += obj->length + 1;
+    const Tcl_ObjType *t = obj->typePtr;
+    if (t == NULL || depth >= TDB_MEM_DEPTH) return size;
+    if (t == tdbListType) {
+        int n = 0;
+        Tcl_Obj **elems = NULL;
+        Tcl_ListObjGetElements(NULL, obj, &n, &elems);
+        size += 4 * sizeof(int) + (Tcl_WideInt)n * sizeof(Tcl_Obj *);
+        for (int i = 0; i < n; i++) size += TdbMemSize(seen, elems[i], depth + 1);
+    } else if (t == tdbDictType) {
+        Tcl_DictSearch search;
+        Tcl_Obj *key, *value;
+        int done = 1;
+        size += sizeof(Tcl_HashTable) + 4 * sizeof(void *);
+        if (Tcl_DictObjFirst(NULL, obj, &search, &key, &value, &done) == TCL_OK) {
+            for (; !done; Tcl_DictObjNext(&search, &key, &value, &done)) {
+                size += TDB_MEM_VAR + TdbMemSize(seen, key, depth + 1) + TdbMemSize(seen, value, depth + 1);
+            }
+            Tcl_DictObjDone(&search);
+        }
+    } else if (t == tdbByteArrayType) {
+        int len = 0;
+        (void)Tcl_GetByteArrayFromObj(obj, &len);
+        size += 2 * sizeof(int) + len;
+    } else if (t == tdbStringType) {
+        size += 3 * sizeof(int) + (Tcl_WideInt)Tcl_GetCharLength(obj) * sizeof(Tcl_UniChar);
+    }
+    return size;
+}
+
+static int
+CompareMemVars(const void *a, const void *b)
+{
+    const TdbMemVar *x = (const TdbMemVar *)a, *y = (const TdbMemVar *)b;
+    if (x->size != y->size) return x->size < y->size ? 1 : -1;
+    return strcmp(Tcl_GetString(x->name), Tcl_GetString(y->name));
+}
+
+/* Size every variable in names (resolved in the current frame) and leave
+ * {scope .. total .. count .. undefined .. top {{name n size b type scalar|array ?elements n?} ..}}
+ * in the result */
+static int
+TdbMemoryReport(Tcl_Interp *interp, Tcl_Obj *names, int top, Tcl_Obj *scope)
+{
+    int n = 0;
+    Tcl_Obj **namev = NULL;
+    if (Tcl_ListObjGetElements(interp, names, &n, &namev) != TCL_OK) return TCL_ERROR;
+    Tcl_IncrRefCount(names);
+    TdbMemVar *vars = (TdbMemVar *)ckalloc((n ? n : 1) * sizeof(TdbMemVar));
+    Tcl_HashTable seen;
+    Tcl_InitHashTable(&seen, TCL_ONE_WORD_KEYS);
+    Tcl_Obj *arrayGet[3], *arrayExists[3];
+    arrayGet[0] = arrayExists[0] = Tcl_NewStringObj("::array", -1);
+    arrayGet[1] = Tcl_NewStringObj("get", -1);
+    arrayExists[1] = Tcl_NewStringObj("exists", -1);
+    Tcl_IncrRefCount(arrayGet[0]);
+    Tcl_IncrRefCount(arrayGet[1]);
+    Tcl_IncrRefCount(arrayExists[1]);
+    Tcl_WideInt total = 0;
+    int count = 0, undefined = 0;
+    for (int i = 0; i < n; i++) {
+        TdbMemVar *v = &vars[count];
+        v->name = namev[i];
+        v->size = TDB_MEM_VAR + namev[i]->length;
+        v->isArray = 0;
+        v->elements = 0;
+        Tcl_Obj *value = Tcl_GetVar2Ex(interp, Tcl_GetString(namev[i]), NULL, 0);
+        if (value) {
+            v->size += TdbMemSize(&seen, value, 0);
+        } else {
+            /* Not readable as a scalar: an array, or declared without a value */
+            int isArray = 0;
+            arrayExists[2] = namev[i];
+            if (Tcl_EvalObjv(interp, 3, arrayExists, 0) != TCL_OK ||
+                Tcl_GetBooleanFromObj(NULL, Tcl_GetObjResult(interp), &isArray) != TCL_OK || !isArray) {
+                undefined++;
+                continue;
+            }
+            /* Arrays: [array get] copies only the list, not the elements */
+            arrayGet[2] = namev[i];
+            if (Tcl_EvalObjv(interp, 3, arrayGet, 0) != TCL_OK) continue;
+            Tcl_Obj *flat = Tcl_GetObjResult(interp);
+            Tcl_IncrRefCount(flat);
+            int m = 0;
+            Tcl_Obj **kv = NULL;
+            Tcl_ListObjGetElements(NULL, flat, &m, &kv);
+            v->isArray = 1;
+            v->elements = m / 2;
+            v->size += sizeof(Tcl_HashTable);
+            for (int j = 0; j + 1 < m; j += 2) {
+                v->size += TDB_MEM_VAR + kv[j]->length + 1 + TdbMemSize(&seen, kv[j+1], 0);
+            }
+            Tcl_DecrRefCount(flat);
+        }
+        total += v->size;
+        count++;
+    }
+    Tcl_DecrRefCount(arrayGet[0]);
+    Tcl_DecrRefCount(arrayGet[1]);
+    Tcl_DecrRefCount(arrayExists[1]);
+    Tcl_ResetResult(interp);
+    Tcl_DeleteHashTable(&seen);
+    qsort(vars, count, sizeof(TdbMemVar), CompareMemVars);
+
+    Tcl_Obj *list = Tcl_NewListObj(0, NULL);
+    for (int i = 0; i < count && (top <= 0 || i < top); i++) {
+        Tcl_Obj *d = Tcl_NewDictObj();
+        Tcl_DictObjPut(NULL, d, Tcl_NewStringObj("name", -1), vars[i].name);
+        Tcl_DictObjPut(NULL, d, Tcl_NewStringObj("size", -1), Tcl_NewWideIntObj(vars[i].size));
+        Tcl_DictObjPut(NULL, d, Tcl_NewStringObj("type", -1), Tcl_NewStringObj(vars[i].isArray ? "array" : "scalar", -1));
+        if (vars[i].isArray) Tcl_DictObjPut(NULL, d, Tcl_NewStringObj("elements", -1), Tcl_NewIntObj(vars[i].elements));
+        Tcl_ListObjAppendElement(NULL, list, d);
+    }
+    Tcl_Obj *out = Tcl_NewDictObj();
+    Tcl_DictObjPut(NULL, out, Tcl_NewStringObj("scope", -1), scope);
+    Tcl_DictObjPut(NULL, out, Tcl_NewStringObj("total", -1), Tcl_NewWideIntObj(total));
+    Tcl_DictObjPut(NULL, out, Tcl_NewStringObj("count", -1), Tcl_NewIntObj(count));
+    Tcl_DictObjPut(NULL, out, Tcl_NewStringObj("undefined", -1), Tcl_NewIntObj(undefined));
+    Tcl_DictObjPut(NULL, out, Tcl_NewStringObj("top", -1), list);
+    ckfree((char *)vars);
+    Tcl_DecrRefCount(names);
+    Tcl_SetObjResult(interp, out);
+    return TCL_OK;
+}
+
+/* tdb::_memory_locals top scope -- report on the calling frame's locals
+ * (its globals at level 0); run through [uplevel #n] so variable lookups
+ * resolve in that frame */
+static int
+TdbMemoryLocalsCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    (void)cd;
+    int top, level = 0;
+    if (objc != 3) {
+        Tcl_WrongNumArgs(interp, 1, objv, "top scope");
+        return TCL_ERROR;
+    }
+    if (Tcl_GetIntFromObj(interp, objv[1], &top) != TCL_OK) return TCL_ERROR;
+    if (Tcl_EvalEx(interp, "::info level", -1, 0) != TCL_OK ||
+        Tcl_GetIntFromObj(interp, Tcl_GetObjResult(interp), &level) != TCL_OK) return TCL_ERROR;
+    if (Tcl_EvalEx(interp, level == 0 ? "::info globals" : "::info locals", -1, 0) != TCL_OK) return TCL_ERROR;
+    return TdbMemoryReport(interp, Tcl_GetObjResult(interp), top, objv[2]);
+}
+
+/* tdb::memory ?-level n? ?-namespace ns? ?-top k? */
+static int
+TdbMemoryCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    (void)cd;
+    int top = TDB_MEM_TOP, level = -1;
+    Tcl_Obj *ns = NULL;
+    if ((objc - 1) % 2 != 0) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?-level n? ?-namespace ns? ?-top k?");
+        Tcl_SetErrorCode(interp, "TDB", "MEMORY", "USAGE", NULL);
+        return TCL_ERROR;
+    }
+    for (int i = 1; i < objc; i += 2) {
+        const char *opt = Tcl_GetString(objv[i]);
+        if (strcmp(opt, "-level") == 0) {
+            if (Tcl_GetIntFromObj(NULL, objv[i+1], &level) != TCL_OK || level < 0) {
+                return TdbError(interp, "MEMORY", "VALUE", "-level must be an absolute level >= 0");
+            }
+        } else if (strcmp(opt, "-namespace") == 0) {
+            ns = objv[i+1];
+        } else if (strcmp(opt, "-top") == 0) {
+            if (Tcl_GetIntFromObj(NULL, objv[i+1], &top) != TCL_OK || top < 0) {
+                return TdbError(interp, "MEMORY", "VALUE", "-top must be an integer >= 0");
+            }
+        } else {
+            return TdbError(interp, "MEMORY", "OPTION", "unknown option: should be -level, -namespace or -top");
+        }
+    }
+    if (level >= 0 && ns) return TdbError(interp, "MEMORY", "USAGE", "-level and -namespace are exclusive");
+
+    if (level >= 0) {
+        /* Only a level above the current one is "bad"; report errors from
+         * the scan itself as they are */
+        int current = 0;
+        if (Tcl_EvalEx(interp, "::info level", -1, 0) != TCL_OK ||
+            Tcl_GetIntFromObj(interp, Tcl_GetObjResult(interp), &current) != TCL_OK) return TCL_ERROR;
+        Tcl_ResetResult(interp);
+        if (level > current) return TdbError(interp, "MEMORY", "LEVEL", "bad level");
+        char buf[TCL_INTEGER_SPACE + 8];
+        snprintf(buf, sizeof(buf), "#%d", level);
+        Tcl_Obj *scope = Tcl_NewListObj(0, NULL);
+        Tcl_ListObjAppendElement(NULL, scope, Tcl_NewStringObj("level", -1));
+        Tcl_ListObjAppendElement(NULL, scope, Tcl_NewIntObj(level));
+        Tcl_Obj *script = Tcl_NewListObj(0, NULL);
+        Tcl_ListObjAppendElement(NULL, script, Tcl_NewStringObj("::tdb::_memory_locals", -1));
+        Tcl_ListObjAppendElement(NULL, script, Tcl_NewIntObj(top));
+        Tcl_ListObjAppendElement(NULL, script, scope);
+        Tcl_Obj *words[3];
+        words[0] = Tcl_NewStringObj("::uplevel", -1);
+        words[1] = Tcl_NewStringObj(buf, -1);
+        words[2] = script;
+        for (int i = 0; i < 3; i++) Tcl_IncrRefCount(words[i]);
+        int rc = Tcl_EvalObjv(interp, 3, words, 0);
+        for (int i = 0; i < 3; i++) Tcl_DecrRefCount(words[i]);
+        return rc;
+    }
+
+    if (ns && Tcl_FindNamespace(interp, Tcl_GetString(ns), NULL, TCL_GLOBAL_ONLY) == NULL) {
+        return TdbError(interp, "MEMORY", "NAMESPACE", "unknown namespace");
+    }
+    /* Globals by default; qualified names resolve from any frame */
+    Tcl_Obj *scope = Tcl_NewListObj(0, NULL);
+    Tcl_Obj *pattern;
+    if (ns) {
+        const char *nsName = Tcl_GetString(ns);
+        pattern = Tcl_NewStringObj(nsName[0] == ':' && nsName[1] == ':' ? "" : "::", -1);
+        Tcl_AppendObjToObj(pattern, ns);
+        if (strcmp(Tcl_GetString(pattern), "::") != 0) Tcl_AppendToObj(pattern, "::", 2);
+        Tcl_ListObjAppendElement(NULL, scope, Tcl_NewStringObj("namespace", -1));
+        Tcl_ListObjAppendElement(NULL, scope, ns);
+    } else {
+        pattern = Tcl_NewStringObj("::", -1);
+        Tcl_ListObjAppendElement(NULL, scope, Tcl_NewStringObj("global", -1));
+    }
+    Tcl_AppendToObj(pattern, "*", 1);
+    Tcl_Obj *words[3];
+    words[0] = Tcl_NewStringObj("::info", -1);
+    words[1] = Tcl_NewStringObj("vars", -1);
+    words[2] = pattern;
+    for (int i = 0; i < 3; i++) Tcl_IncrRefCount(words[i]);
+    Tcl_IncrRefCount(scope);
+    int rc = Tcl_EvalObjv(interp, 3, words, TCL_EVAL_GLOBAL);
+    for (int i = 0; i < 3; i++) Tcl_DecrRefCount(words[i]);
+    if (rc == TCL_OK) rc = TdbMemoryReport(interp, Tcl_GetObjResult(interp), top, scope);
+    Tcl_DecrRefCount(scope);
+    return rc;
+}
+
 /* ----------------------------------------------------------------------
  * Package init
  * ---------------------------------------------------------------------- */
 
+/*
+ * The Tcl half of the debugger (stepping, locals, eval, continue) is
+ * compiled in as tdbShimScript and evaluated on the first tdb::start or on
+ * the first call to one of its public procs, so a package require that
+ * never debugs only creates the C commands below.
+ */
+static const char *const tdbShimCommands[] = {
+    "::tdb::step", "::tdb::rununtil", "::tdb::locals", "::tdb::globals",
+    "::tdb::eval", "::tdb::continue", "::tdb::last-stop",
+    "::tdb::register_command_syntax", NULL
+};
+
+static const char *const tdbExports[] = {
+    "start", "stop", "config", "break", "wait", "on", "continue", "last-stop",
+    "stats", "coverage", "json", "event", "memory", NULL
+};
+
+static int
+TdbShimLoad(Tcl_Interp *interp)
+{
+    TdbState *state = TdbGetState(interp);
+    if (state->shimLoaded) return TCL_OK;
+    state->shimLoaded = 1;
+    if (Tcl_EvalEx(interp, tdbShimScript, -1, TCL_EVAL_GLOBAL) != TCL_OK) {
+        state->shimLoaded = 0;
+        Tcl_AddErrorInfo(interp, "\n    (evaluating embedded tdb library script)");
+        return TCL_ERROR;
+    }
+    Tcl_ResetResult(interp);
+    return TCL_OK;
+}
+
+/* Placeholder for a shim proc: load the script, then call the real proc */
+static int
+TdbShimStubCmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    const char *name = (const char *)cd;
+    Tcl_CmdInfo info;
+    Tcl_Obj **words;
+    int code;
+
+    if (TdbShimLoad(interp) != TCL_OK) return TCL_ERROR;
+    if (!Tcl_GetCommandInfo(interp, name, &info) || info.objProc == TdbShimStubCmd) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("library script does not define \"%s\"", name));
+        Tcl_SetErrorCode(interp, "TDB", "SHIM", "MISSING", NULL);
+        return TCL_ERROR;
+    }
+    words = (Tcl_Obj **)ckalloc(objc * sizeof(Tcl_Obj *));
+    words[0] = Tcl_NewStringObj(name, -1);
+    for (int i = 1; i < objc; i++) words[i] = objv[i];
+    for (int i = 0; i < objc; i++) Tcl_IncrRefCount(words[i]);
+    code = Tcl_EvalObjv(interp, objc, words, 0);
+    for (int i = 0; i < objc; i++) Tcl_DecrRefCount(words[i]);
+    ckfree((char *)words);
+    return code;
+}
+
 static int
 TdbRegisterCommands(Tcl_Interp *interp)
 {
@@ -995,8 +4515,32 @@ TdbRegisterCommands(Tcl_Interp *interp)
     Tcl_CreateObjCommand(interp, "tdb::_pauseNow", TdbPauseNowCmd, NULL, NULL);
     Tcl_CreateObjCommand(interp, "tdb::stats", TdbStatsCmd, NULL, NULL);
     Tcl_CreateObjCommand(interp, "tdb::_match_fileline", TdbMatchFileLineCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "tdb::_proc_bps", TdbProcBpsCmd, NULL, NULL);
     Tcl_CreateObjCommand(interp, "tdb::_stop_event", TdbStopEventCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "tdb::_log_event", TdbLogEventCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "tdb::_stop_locals", TdbStopLocalsCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "tdb::_bp_admit", TdbBpAdmitCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "tdb::_charge", TdbChargeCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "tdb::_now", TdbNowCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "tdb::_lat", TdbLatencyHookCmd, TdbGetState(interp), NULL);
+    Tcl_CreateObjCommand(interp, "tdb::_latRetry", TdbLatencyRetryCmd, TdbGetState(interp), NULL);
+    Tcl_CreateObjCommand(interp, "tdb::wait", TdbWaitCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "tdb::on", TdbOnCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "tdb::coverage", TdbCoverageCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "tdb::json", TdbJsonCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "tdb::event", TdbEventCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "tdb::frames", TdbFramesCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "tdb::memory", TdbMemoryCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "tdb::_memory_locals", TdbMemoryLocalsCmd, NULL, NULL);
     Tcl_CreateObjCommand(interp, "tdb::_enterPause", TdbEnterPauseCmd, NULL, NULL);
+    for (int i = 0; tdbShimCommands[i] != NULL; i++) {
+        Tcl_CreateObjCommand(interp, tdbShimCommands[i], TdbShimStubCmd,
+                             (ClientData)tdbShimCommands[i], NULL);
+    }
+    Tcl_Namespace *ns = Tcl_FindNamespace(interp, "::tdb", NULL, 0);
+    for (int i = 0; ns != NULL && tdbExports[i] != NULL; i++) {
+        if (Tcl_Export(interp, ns, tdbExports[i], 0) != TCL_OK) return TCL_ERROR;
+    }
     return TCL_OK;
 }
 
@@ -1004,6 +4548,17 @@ int
 Tdb_Init(Tcl_Interp *interp)
 {
     if (Tcl_InitStubs(interp, "8.5", 0) == NULL) return TCL_ERROR;
+    if (tdbDictType == NULL) {
+        /* Types a build does not register stay NULL (wideInt on 64-bit
+         * 8.6); TdbJsonEncode never matches a NULL type */
+        tdbDictType = Tcl_GetObjType("dict");
+        tdbListType = Tcl_GetObjType("list");
+        tdbIntType = Tcl_GetObjType("int");
+        tdbWideIntType = Tcl_GetObjType("wideInt");
+        tdbDoubleType = Tcl_GetObjType("double");
+        tdbByteArrayType = Tcl_GetObjType("bytearray");
+        tdbStringType = Tcl_GetObjType("string");
+    }
     if (TdbRegisterCommands(interp) != TCL_OK) return TCL_ERROR;
     if (Tcl_PkgProvide(interp, "tdb", "0.1") != TCL_OK) return TCL_ERROR;
     return TCL_OK;
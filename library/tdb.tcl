@@ -1,43 +1,24 @@
-namespace eval ::tdb {
-    namespace export start stop config break wait continue last-stop stats
-}
-
-proc ::tdb::_install_stub {cmd} {
-    set target ::tdb::${cmd}
-    set native ::tdb::${cmd}_native
-    if {[namespace which $target] ne ""} {
-        rename $target $native
-    } else {
-        proc $native {args} {
-            return -code error "Tdb C command $cmd not available"
-        }
-    }
-    interp alias {} $target {} $native
-}
-
-foreach cmd {start stop config break stats} {
-    ::tdb::_install_stub $cmd
-}
+# Tcl half of tdb.  The build compiles this file into the shared library
+# (tdb_library.h) and the engine evaluates it on the first tdb::start or
+# first call to one of the procs below; the C commands exist from load.
 
-# File:line support via Tcl execution traces (enabled only when file bps exist)
-
-proc ::tdb::_has_file_bps {} {
-    foreach bp [tdb::break ls] {
-        if {[dict get $bp type] eq "file"} { return 1 }
-    }
-    return 0
-}
+# Proc breakpoints via Tcl execution traces (enabled only when proc bps exist)
 
 proc ::tdb::_execStep {procName cmd args} {
-    # Handle both proc and file:line breakpoints at the first enterstep
+    # Handle proc breakpoints at the first enterstep; file:line breakpoints
+    # are matched by the engine's object trace
     set event [lindex $args 0]
     if {$event ne "enterstep"} { return }
+    # -perf.budget charges a hit from here, frame lookup included
+    set tIn [::tdb::_now]
     set fr [info frame -2]
     if {![dict exists $fr level]} { return }
     set absLevel [dict get $fr level]
-    # Ensure we only evaluate once per invocation at the first enterstep
-    if {[info exists ::tdb::_proc_step_once($absLevel)]} { return }
-    set ::tdb::_proc_step_once($absLevel) 1
+    # Ensure we only evaluate once per invocation at the first enterstep.
+    # Levels restart inside each coroutine, so key the guard by coroutine too.
+    set once [::tdb::_coroutine]:$absLevel
+    if {[info exists ::tdb::_proc_step_once($once)]} { return }
+    set ::tdb::_proc_step_once($once) 1
 
     # Resolve proc name from trace installation (procName), fallback to frame
     set pname ""
@@ -53,21 +34,18 @@ proc ::tdb::_execStep {procName cmd args} {
         set publishEv 0
         set ev {}
         set rmId {}
-        foreach bp [tdb::break ls] {
-            # Filter non-proc or non-matching bps
-            set typ ""; set bpproc ""
-            set matches 0
-            if {[catch {dict get $bp type} typ] == 0 && $typ eq "proc" && \
-                [catch {dict get $bp proc} bpproc] == 0 && \
-                [expr {$pname eq $bpproc || ([string match ::* $bpproc] && [string trimleft $bpproc : ] eq $pname)}]} {
-                set matches 1
-            }
-            if {$matches} {
+        foreach bp [tdb::_proc_bps $pname] {
+            # Latency breakpoints (-slowerThan) are timed by the engine
+            set matches [expr {![dict exists $bp slowerThan]}]
+            if {$matches && [::tdb::_coroutine_ok $bp]} {
                 # Hit-counts and conditions
                 set id [dict get $bp id]
                 if {![info exists ::tdb::_bp_hits($id)]} { set ::tdb::_bp_hits($id) 0 }
                 incr ::tdb::_bp_hits($id)
                 set hits $::tdb::_bp_hits($id)
+                # Over-budget breakpoints are sampled or disabled (-perf.budget)
+                set t0 [::tdb::_bp_admit $id $tIn]
+                if {$t0 eq ""} { ::continue }
                 # Condition
                 set condOK 1
                 if {[dict exists $bp condition]} {
@@ -87,7 +65,7 @@ proc ::tdb::_execStep {procName cmd args} {
                             set tmpl [dict get $bp log]
                             set msg ""
                             catch { set msg [uplevel [format {#%d} $absLevel] [list subst -nocommands -nobackslashes $tmpl]] }
-                            if {$msg ne ""} { puts $msg }
+                            ::tdb::_emit_log $fr $id $msg
                             if {[dict exists $bp oneshot] && [dict get $bp oneshot]} { catch { tdb::break rm $id } }
                         } else {
                             # Build the stop event
@@ -100,26 +78,22 @@ proc ::tdb::_execStep {procName cmd args} {
                             dict set ev level $absLevel
                             set publishEv 1
                             if {[dict exists $bp oneshot] && [dict get $bp oneshot]} { set rmId $id }
+                            set evId $id
                         }
                     }
                 }
+                # The next breakpoint is charged from here
+                set tIn [::tdb::_charge $id $t0]
             }
         }
         if {$publishEv} {
             set ev [::tdb::_annotate_syntax $ev]
-            set ::tdb::_last_stop $ev
-            set ::tdb::_stopped $ev
+            ::tdb::_stop_event $ev
+            ::tdb::_charge $evId $tIn
             if {$rmId ne ""} { catch { tdb::break rm $rmId } }
             return
         }
     }
-
-    # 2) File:line breakpoints at this step
-    if {[dict exists $fr file] && [dict exists $fr line]} {
-        set f [file normalize [dict get $fr file]]
-        set l [dict get $fr line]
-        ::tdb::_apply_fileline_breaks $fr $f $l
-    }
 }
 
 proc ::tdb::_execProcEnter {cmd args} {
@@ -136,7 +110,7 @@ proc ::tdb::_execLeave {procName cmd args} {
             catch { unset -nocomplain ::tdb::_proc_seen($lvl) }
         }
         if {[array exists ::tdb::_proc_step_once]} {
-            catch { unset -nocomplain ::tdb::_proc_step_once($lvl) }
+            catch { unset -nocomplain ::tdb::_proc_step_once([::tdb::_coroutine]:$lvl) }
         }
     }
 }
@@ -152,23 +126,16 @@ proc ::tdb::_ensure_exec_traces {} {
 
 array set ::tdb::_bp_hits {}
 
-proc ::tdb::_fileline_bps {f l} {
-    set out {}
-    foreach bp [tdb::break ls] {
-        set typ ""
-        set bpfile ""
-        set bpline -1
-        if {[catch {dict get $bp type} typ] == 0 && $typ eq "file" && \
-            [dict exists $bp file] && [dict exists $bp line] && \
-            [catch {dict get $bp file} bpfile] == 0 && \
-            [catch {dict get $bp line} bpline] == 0} {
-            # Allow a one-line drift between reported frame line and declared bp line
-            if {[file normalize $bpfile] eq $f && abs([expr {$bpline - $l}]) <= 2} {
-                lappend out $bp
-            }
-        }
-    }
-    return $out
+proc ::tdb::_coroutine {} {
+    # Current coroutine name, or "" outside coroutines (and on Tcl 8.5)
+    if {[catch {info coroutine} coro]} { return "" }
+    return $coro
+}
+
+proc ::tdb::_coroutine_ok {bp} {
+    # -coroutine filter, checked before hit counting and conditions
+    if {![dict exists $bp coroutine]} { return 1 }
+    return [string match [dict get $bp coroutine] [::tdb::_coroutine]]
 }
 
 proc ::tdb::_parse_hit {spec hits} {
@@ -184,15 +151,24 @@ proc ::tdb::_parse_hit {spec hits} {
     return 0
 }
 
-proc ::tdb::_apply_fileline_breaks {fr f l} {
-    set bps [::tdb::_fileline_bps $f $l]
-    if {![llength $bps]} { return }
+proc ::tdb::_apply_fileline_breaks {fr f l ids {tIn 0}} {
+    # Called by the engine's object trace for a command on the line the
+    # breakpoints in ids stop on; tIn is when the hit started, so the first
+    # admitted breakpoint is charged for the engine's frame lookup too
+    set bps {}
+    foreach id $ids {
+        if {![catch { tdb::break get $id } bp]} { lappend bps $bp }
+    }
     set absLevel [dict get $fr level]
     foreach bp $bps {
+        if {![::tdb::_coroutine_ok $bp]} { ::continue }
         set id [dict get $bp id]
         if {![info exists ::tdb::_bp_hits($id)]} { set ::tdb::_bp_hits($id) 0 }
         incr ::tdb::_bp_hits($id)
         set hits $::tdb::_bp_hits($id)
+        # Over-budget breakpoints are sampled or disabled (-perf.budget)
+        set t0 [::tdb::_bp_admit $id $tIn]
+        if {$t0 eq ""} { ::continue }
 
         # Condition
         set condOK 1
@@ -205,8 +181,8 @@ proc ::tdb::_apply_fileline_breaks {fr f l} {
         }
         if {!$condOK} { 
             # Skip this breakpoint silently
-            set condOK 0
-            continue
+            set tIn [::tdb::_charge $id $t0]
+            ::continue
         }
 
         # Hit-count
@@ -214,7 +190,8 @@ proc ::tdb::_apply_fileline_breaks {fr f l} {
         if {[dict exists $bp hitCount]} { set spec [dict get $bp hitCount] }
         if {$spec ne "" && ![::tdb::_parse_hit $spec $hits]} { 
             # Skip this breakpoint silently
-            continue 
+            set tIn [::tdb::_charge $id $t0]
+            ::continue 
         }
 
         # Log-only
@@ -225,12 +202,9 @@ proc ::tdb::_apply_fileline_breaks {fr f l} {
                 # ignore interpolation errors
                 set msg ""
             }
-            if {$msg ne ""} { puts $msg }
-            # Record a non-pausing log event
-            set logEv $fr
-            dict set logEv event log
-            dict set logEv reason logpoint
-            set ::tdb::_last_stop $logEv
+            # Print and queue a non-pausing log event
+            ::tdb::_emit_log $fr $id $msg
+            ::tdb::_charge $id $t0
             # Treat logpoints as non-pausing one-shot by default to avoid
             # unintended subsequent pauses on the same line in tight loops.
             catch { tdb::break rm $id }
@@ -252,7 +226,7 @@ proc ::tdb::_apply_fileline_breaks {fr f l} {
         set localNames {}
         catch { set localNames [uplevel [format {#%d} $absLevel] {info locals}] }
         foreach n $localNames {
-            if {$n eq ""} continue
+            if {$n eq ""} ::continue
             set v ""
             catch { set v [uplevel [format {#%d} $absLevel] [list set $n]] }
             dict set snapshot $n $v
@@ -262,16 +236,17 @@ proc ::tdb::_apply_fileline_breaks {fr f l} {
             set argNames {}
             catch { set argNames [info args $procName] }
             foreach a $argNames {
-                if {[dict exists $snapshot $a]} { continue }
+                if {[dict exists $snapshot $a]} { ::continue }
                 set v ""
                 catch { set v [uplevel [format {#%d} $absLevel] [list set $a]] }
                 dict set snapshot $a $v
             }
         }
+        # The engine publishes this as a localsDelta against the previous stop
         dict set ev locals $snapshot
         set ev [::tdb::_annotate_syntax $ev]
-        set ::tdb::_last_stop $ev
-        set ::tdb::_stopped $ev
+        ::tdb::_stop_event $ev
+        ::tdb::_charge $id $t0
         if {[dict exists $bp oneshot] && [dict get $bp oneshot]} { catch { tdb::break rm $id } }
         return
     }
@@ -285,12 +260,9 @@ proc ::tdb::_apply_method_breaks {objName methodName} {
     set fr [info frame -1]
     if {![dict exists $fr level]} { return }
     set absLevel [dict get $fr level]
-    foreach bp [tdb::break ls] {
-        set typ ""; set pat ""; set mname ""
-        if {[catch {dict get $bp type} typ] != 0 || $typ ne "method"} { continue }
-        if {[catch {dict get $bp pattern} pat] != 0} { continue }
-        if {[catch {dict get $bp method} mname] != 0} { continue }
-        if {![string match $pat $objName] || $mname ne $methodName} { continue }
+    foreach bp [tdb::break query -type method -method $methodName] {
+        if {![string match [dict get $bp pattern] $objName]} { ::continue }
+        if {![::tdb::_coroutine_ok $bp]} { ::continue }
 
         set id [dict get $bp id]
         if {![info exists ::tdb::_bp_hits($id)]} { set ::tdb::_bp_hits($id) 0 }
@@ -306,21 +278,21 @@ proc ::tdb::_apply_method_breaks {objName methodName} {
                 set condOK [expr {$ok ? 1 : 0}]
             }
         }
-        if {!$condOK} { continue }
+        if {!$condOK} { ::continue }
 
         # Hit-count filter
         set spec ""
         if {[dict exists $bp hitCount]} { set spec [dict get $bp hitCount] }
-        if {$spec ne "" && ![::tdb::_parse_hit $spec $hits]} { continue }
+        if {$spec ne "" && ![::tdb::_parse_hit $spec $hits]} { ::continue }
 
         # Log-only
         if {[dict exists $bp log] && [dict get $bp log] ne ""} {
             set tmpl [dict get $bp log]
             set msg ""
             catch { set msg [uplevel [format {#%d} $absLevel] [list subst -nocommands -nobackslashes $tmpl]] }
-            if {$msg ne ""} { puts $msg }
+            ::tdb::_emit_log $fr $id $msg
             if {[dict exists $bp oneshot] && [dict get $bp oneshot]} { catch { tdb::break rm $id } }
-            continue
+            ::continue
         }
 
         # Publish stop event, include frame info best-effort
@@ -333,8 +305,7 @@ proc ::tdb::_apply_method_breaks {objName methodName} {
         if {[dict exists $fr cmd]}   { dict set ev cmd   [dict get $fr cmd] }
         if {[dict exists $fr proc]}  { dict set ev proc  [dict get $fr proc] }
         set ev [::tdb::_annotate_syntax $ev]
-        set ::tdb::_last_stop $ev
-        set ::tdb::_stopped $ev
+        ::tdb::_stop_event $ev
         if {[dict exists $bp oneshot] && [dict get $bp oneshot]} { catch { tdb::break rm $id } }
         return
     }
@@ -345,12 +316,9 @@ proc ::tdb::_method_should_pause {objName methodName} {
     set fr [info frame -1]
     if {![dict exists $fr level]} { return 0 }
     set absLevel [dict get $fr level]
-    foreach bp [tdb::break ls] {
-        set typ ""; set pat ""; set mname ""
-        if {[catch {dict get $bp type} typ] != 0 || $typ ne "method"} { continue }
-        if {[catch {dict get $bp pattern} pat] != 0} { continue }
-        if {[catch {dict get $bp method} mname] != 0} { continue }
-        if {![string match $pat $objName] || $mname ne $methodName} { continue }
+    foreach bp [tdb::break query -type method -method $methodName] {
+        if {![string match [dict get $bp pattern] $objName]} { ::continue }
+        if {![::tdb::_coroutine_ok $bp]} { ::continue }
         set id [dict get $bp id]
         if {![info exists ::tdb::_bp_hits($id)]} { set ::tdb::_bp_hits($id) 0 }
         incr ::tdb::_bp_hits($id)
@@ -364,19 +332,19 @@ proc ::tdb::_method_should_pause {objName methodName} {
                 set condOK [expr {$ok ? 1 : 0}]
             }
         }
-        if {!$condOK} { continue }
+        if {!$condOK} { ::continue }
         # Hit-count
         set spec ""
         if {[dict exists $bp hitCount]} { set spec [dict get $bp hitCount] }
-        if {$spec ne "" && ![::tdb::_parse_hit $spec $hits]} { continue }
+        if {$spec ne "" && ![::tdb::_parse_hit $spec $hits]} { ::continue }
         # Log-only
         if {[dict exists $bp log] && [dict get $bp log] ne ""} {
             set tmpl [dict get $bp log]
             set msg ""
             catch { set msg [uplevel [format {#%d} $absLevel] [list subst -nocommands -nobackslashes $tmpl]] }
-            if {$msg ne ""} { puts $msg }
+            ::tdb::_emit_log $fr $id $msg
             if {[dict exists $bp oneshot] && [dict get $bp oneshot]} { catch { tdb::break rm $id } }
-            continue
+            ::continue
         }
         if {[dict exists $bp oneshot] && [dict get $bp oneshot]} { catch { tdb::break rm $id } }
         return 1
@@ -389,6 +357,8 @@ proc ::tdb::_method_should_pause {objName methodName} {
 variable _stepMode
 variable _stepDepth
 variable _stepProc
+variable _stepCoro
+set ::tdb::_stepTargets {}
 
 proc ::tdb::step {mode args} {
     if {[lsearch -exact {in over out} $mode] < 0} {
@@ -405,10 +375,20 @@ proc ::tdb::step {mode args} {
     set q [namespace which -command $::tdb::_stepProc]
     if {$q ne ""} { set ::tdb::_stepProc $q }
     set ::tdb::_stepDepth [dict get $ev level]
-    catch { trace remove execution $::tdb::_stepProc enterstep ::tdb::_stepDispatch }
-    catch { trace remove execution $::tdb::_stepProc leavestep ::tdb::_stepDispatch }
-    if {$mode eq "out"} { catch { trace add execution $::tdb::_stepProc leavestep ::tdb::_stepDispatch } } \
-    else { catch { trace add execution $::tdb::_stepProc enterstep ::tdb::_stepDispatch } }
+    # Follow the stopped coroutine only; its levels are coroutine-relative
+    set ::tdb::_stepCoro ""
+    if {[dict exists $ev coroutine]} { set ::tdb::_stepCoro [dict get $ev coroutine] }
+    ::tdb::_stepDisarm
+    # A step trace on the proc only exists for activations entered after it
+    # is added, and the last activation to leave removes it for all.  A
+    # suspended coroutine is stepped through the coroutine command instead,
+    # whose trace is re-created on every resume.
+    set ::tdb::_stepTargets [list $::tdb::_stepProc]
+    if {$::tdb::_stepCoro ne ""} { lappend ::tdb::_stepTargets $::tdb::_stepCoro }
+    set ops [expr {$mode eq "out" ? "leavestep" : "enterstep"}]
+    foreach target $::tdb::_stepTargets {
+        catch { trace add execution $target $ops ::tdb::_stepDispatch }
+    }
     # In non-blocking test mode, return a synthetic step event immediately
     if {$doWait} {
         set ev0 $ev
@@ -417,21 +397,39 @@ proc ::tdb::step {mode args} {
         if {[dict exists $ev0 file]} { dict set out file [dict get $ev0 file] }
         if {[dict exists $ev0 line]} { dict set out line [dict get $ev0 line] }
         if {[dict exists $ev0 level]} { dict set out level [dict get $ev0 level] }
+        if {$::tdb::_stepCoro ne ""} { dict set out coroutine $::tdb::_stepCoro }
         set ::tdb::_last_stop $out
         return $out
     }
     return
 }
 
+proc ::tdb::_stepDisarm {} {
+    foreach target $::tdb::_stepTargets {
+        catch { trace remove execution $target enterstep ::tdb::_stepDispatch }
+        catch { trace remove execution $target leavestep ::tdb::_stepDispatch }
+    }
+    set ::tdb::_stepTargets {}
+}
+
 proc ::tdb::_stepDispatch {cmd args} {
     upvar ::tdb::_stepMode mode ::tdb::_stepDepth depth
+    # Both step targets may see the same command; only the first one counts
+    if {![llength $::tdb::_stepTargets]} { return }
+    # Other coroutines running the same proc (or the resumer after a yield)
+    # must not end the step
+    if {[::tdb::_coroutine] ne $::tdb::_stepCoro} { return }
     set fr [info frame -2]
     set curDepth [dict get $fr level]
     set reason "step"
     set hit 0
-    if {$mode eq "in"} { set hit 1 }
-    elseif {$mode eq "over"} { if {$curDepth <= $depth} { set hit 1 } }
-    elseif {$mode eq "out"} { set hit 1 }
+    if {$mode eq "in"} {
+        set hit 1
+    } elseif {$mode eq "over"} {
+        if {$curDepth <= $depth} { set hit 1 }
+    } elseif {$mode eq "out"} {
+        set hit 1
+    }
     if {$hit} {
         set ev $fr
         dict set ev event stopped
@@ -440,10 +438,8 @@ proc ::tdb::_stepDispatch {cmd args} {
         if {[dict exists $fr file]} { dict set ev file [dict get $fr file] }
         if {[dict exists $fr line]} { dict set ev line [dict get $fr line] }
         set ev [::tdb::_annotate_syntax $ev]
-        set ::tdb::_last_stop $ev
-        set ::tdb::_stopped $ev
-        catch { trace remove execution $::tdb::_stepProc enterstep ::tdb::_stepDispatch }
-        catch { trace remove execution $::tdb::_stepProc leavestep ::tdb::_stepDispatch }
+        ::tdb::_stepDisarm
+        ::tdb::_stop_event $ev
     }
 }
 
@@ -454,27 +450,36 @@ proc ::tdb::rununtil {target args} {
         return -code error "usage: tdb::rununtil file:/abs/path:line ?-wait?"
     }
     tdb::break add -file [file normalize $f] -line $l -oneshot 1
-    ::tdb::_ensure_exec_traces
     if {$doWait} { return [::tdb::continue -wait] }
     ::tdb::continue
 }
 
 # --- Introspection and eval ---
 
-proc ::tdb::frames {} {
-    # Return a list of dicts for visible frames around the paused state.
-    if {![info exists ::tdb::_last_stop]} { return {} }
-    set abs [dict get $::tdb::_last_stop level]
-    set out {}
-    # Include a small window of frames around abs
-    for {set d [expr {$abs}]} {$d >= 0 && [llength $out] < 20} {incr d -1} {
-        if {[catch {set fr [info frame [format {#%d} $d]]}]} { break }
-        lappend out $fr
-    }
-    return $out
+# Stop events carry a localsDelta; the full snapshot behind the current stop
+# (the latest one, or the one tdb::wait last returned) stays in the engine.
+# Returns 1 and sets snapVar when that stop has one.
+proc ::tdb::_snapshot {snapVar} {
+    upvar 1 $snapVar snap
+    if {[::tdb::_stop_locals -delta] eq ""} { return 0 }
+    set snap [::tdb::_stop_locals]
+    return 1
 }
 
-proc ::tdb::locals {{level ""}} {
+proc ::tdb::locals {args} {
+    # tdb::locals ?-full|-delta? ?level?
+    set mode full
+    if {[lindex $args 0] in {-full -delta}} {
+        set mode [string range [lindex $args 0] 1 end]
+        set args [lrange $args 1 end]
+    }
+    if {[llength $args] > 1} {
+        return -code error -errorcode {TDB LOCALS USAGE} "usage: tdb::locals ?-full|-delta? ?level?"
+    }
+    if {$mode eq "delta"} {
+        return [::tdb::_stop_locals -delta]
+    }
+    set level [lindex $args 0]
     set uplev {}
     if {$level eq ""} {
         if {![info exists ::tdb::_last_stop]} { return {} }
@@ -494,15 +499,13 @@ proc ::tdb::locals {{level ""}} {
             set uplev $level
         }
     }
-    # Prefer a stable snapshot if present in the last stop event
-    if {[info exists ::tdb::_last_stop] && [dict exists $::tdb::_last_stop locals]} {
-        return [dict get $::tdb::_last_stop locals]
-    }
+    # Prefer the stable snapshot taken at the last stop
+    if {[::tdb::_snapshot snap]} { return $snap }
     # Fallback live lookup (may be empty if frame already advanced)
     if {[catch {set localNames [uplevel $uplev {info locals}]}]} { set localNames {} }
     set out {}
     foreach n $localNames {
-        if {$n eq ""} continue
+        if {$n eq ""} ::continue
         set v ""
         catch { set v [uplevel $uplev [list set $n]] }
         dict set out $n $v
@@ -542,86 +545,216 @@ proc ::tdb::eval {args} {
     # Honor -safeEval configuration; default is 0 (disabled)
     set cfg [tdb::config]
     set doSafe [expr {[dict exists $cfg -safeEval] && [dict get $cfg -safeEval]}]
-    if {[info exists ::tdb::_last_stop] && [dict exists $::tdb::_last_stop locals] && ($doSafe)} {
-        # Evaluate using a safe child interpreter populated with locals snapshot
-        set snap [dict get $::tdb::_last_stop locals]
-        set child [interp create -safe]
-        foreach {k v} $snap {
-            catch { interp eval $child [list set $k $v] }
-        }
-        set rc [catch { interp eval $child $script } val opts]
-        interp delete $child
+    if {$doSafe && [::tdb::_snapshot snap]} {
+        # Evaluate using a pooled safe child interpreter seeded with the locals snapshot
+        lassign [::tdb::_safeEval $snap $script $cfg] rc val opts
         if {$rc} { return -options $opts $val }
         return $val
     }
     # Try in-frame evaluation; if it fails due to missing locals, fall back to snapshot-safe
     set rc [catch { uplevel $uplev $script } val opts]
     if {!$rc} { return $val }
-    if {[info exists ::tdb::_last_stop] && [dict exists $::tdb::_last_stop locals]} {
-        set snap [dict get $::tdb::_last_stop locals]
-        set child [interp create -safe]
-        foreach {k v} $snap {
-            catch { interp eval $child [list set $k $v] }
-        }
-        set rc2 [catch { interp eval $child $script } val2 opts2]
-        interp delete $child
+    if {[::tdb::_snapshot snap]} {
+        lassign [::tdb::_safeEval $snap $script $cfg] rc2 val2 opts2
         if {$rc2} { return -options $opts $val }
         return $val2
     }
     return -options $opts $val
 }
 
-# Pause/wait/continue helpers (pure Tcl)
+# --- Pooled safe interpreters for snapshot evaluation ---
+#
+# Each pooled child remembers the snapshot it was last seeded with
+# (_safeSeed) so the next use only transfers locals that were added, changed
+# or removed, in a single interp eval.  Seeded variables carry a write/unset
+# trace that marks them dirty (_safeDirty) when a watch script touches them;
+# dirty names are re-sent on the next use.  Globals and procs created by the
+# script are dropped on release; a child whose commands, namespaces or procs
+# still differ from its baseline (_safeBase) after that is discarded.
+
+set ::tdb::_safePool {}
+set ::tdb::_safeSweepId ""
+array set ::tdb::_safeSeed {}
+array set ::tdb::_safeDirty {}
+array set ::tdb::_safeBase {}
+
+# Applied in a child: every namespace, every command and every proc
+# definition, sorted, so any rename, deletion or new alias shows up
+set ::tdb::_safeSigLambda {{} {
+    set nss {}
+    set todo [list ::]
+    while {[llength $todo]} {
+        set todo [lassign $todo ns]
+        lappend nss $ns
+        lappend todo {*}[namespace children $ns]
+    }
+    set cmds {}
+    set procs {}
+    foreach ns $nss {
+        set pre [string trimright $ns :]
+        lappend cmds {*}[info commands ${pre}::*]
+        foreach p [info procs ${pre}::*] {
+            lappend procs [list $p [info args $p] [info body $p]]
+        }
+    }
+    list [lsort $nss] [lsort $cmds] [lsort $procs]
+}}
+
+proc ::tdb::_safeEval {snap script cfg} {
+    set child [::tdb::_safeAcquire $snap [dict get $cfg -safeEval.idleMs]]
+    set rc [catch { interp eval $child $script } val opts]
+    ::tdb::_safeRelease $child [dict get $cfg -safeEval.poolSize] [dict get $cfg -safeEval.idleMs]
+    return [list $rc $val $opts]
+}
+
+proc ::tdb::_safeAcquire {snap idle} {
+    ::tdb::_safeSweep $idle
+    while {[llength $::tdb::_safePool]} {
+        # Most recently released first: its seed is likely closest to snap
+        set child [lindex $::tdb::_safePool end 0]
+        set ::tdb::_safePool [lrange $::tdb::_safePool 0 end-1]
+        if {![interp exists $child]} { ::tdb::_safeForget $child; continue }
+        # A pooled child the script left unseedable is replaced below
+        if {![catch { ::tdb::_safeSeedChild $child $snap }]} { return $child }
+        ::tdb::_safeDiscard $child
+    }
+    set child [interp create -safe]
+    if {[catch {
+        interp alias $child ::tdb_dirty {} ::tdb::_safeTouch $child
+        set ::tdb::_safeSeed($child) {}
+        set ::tdb::_safeDirty($child) {}
+        set ::tdb::_safeBase($child) [list [interp eval $child {info globals}] \
+            [interp eval $child {info procs}] [interp eval $child [list ::apply $::tdb::_safeSigLambda]]]
+        ::tdb::_safeSeedChild $child $snap
+    } msg opts]} {
+        ::tdb::_safeDiscard $child
+        return -options $opts $msg
+    }
+    return $child
+}
 
-proc ::tdb::wait {args} {
-    # parse options: -timeout ms
-    set timeout ""
-    if {[llength $args] == 2} {
-        lassign $args opt val
-        if {$opt ne "-timeout"} {
-            return -code error "wrong # args: should be \"tdb::wait ?-timeout ms?\""
+proc ::tdb::_safeSeedChild {child snap} {
+    # Send only the delta against what the child already holds
+    set seed $::tdb::_safeSeed($child)
+    set dirty $::tdb::_safeDirty($child)
+    set delta {}
+    dict for {k v} $snap {
+        if {![dict exists $seed $k] || [dict exists $dirty $k] || [dict get $seed $k] ne $v} {
+            dict set delta $k $v
         }
-        set timeout $val
-    } elseif {[llength $args] != 0} {
-        return -code error "wrong # args: should be \"tdb::wait ?-timeout ms?\""
-    }
-
-    if {[info exists ::tdb::_stopped]} {
-        set ev $::tdb::_stopped
-        unset ::tdb::_stopped
-        return $ev
-    }
-    # Robust wait with write-trace to avoid set-before-vwait races
-    set ::tdb::__woke {}
-    proc ::tdb::__onStopped {name1 name2 op} {
-        set ::tdb::__woke 1
-        catch { trace remove variable ::tdb::_stopped write ::tdb::__onStopped }
-    }
-    trace add variable ::tdb::_stopped write ::tdb::__onStopped
-    # Also schedule a microtask to wake if it was already set
-    after 0 {
-        if {[info exists ::tdb::_stopped]} { set ::tdb::__woke 1 }
-    }
-    set tid ""
-    if {$timeout ne ""} {
-        set ms [expr {int($timeout)}]
-        set tid [after $ms { set ::tdb::__woke __timeout }]
-    }
-    vwait ::tdb::__woke
-    if {$tid ne ""} { after cancel $tid }
-    catch { trace remove variable ::tdb::_stopped write ::tdb::__onStopped }
-    catch { rename ::tdb::__onStopped {} }
-    if {$::tdb::__woke eq "__timeout"} {
-        unset ::tdb::__woke
-        return -code error -errorcode {TDB TIMEOUT} "timeout"
-    }
-    unset ::tdb::__woke
-    if {![info exists ::tdb::_stopped]} {
-        return -code error -errorcode {TDB NOPAUSE} "no pause recorded"
-    }
-    set ev $::tdb::_stopped
-    unset ::tdb::_stopped
-    return $ev
+    }
+    set gone {}
+    dict for {k v} $seed {
+        if {![dict exists $snap $k]} { lappend gone $k }
+    }
+    if {[dict size $delta] || [llength $gone]} {
+        interp eval $child [list ::apply {{delta gone} {
+            foreach k $gone {
+                unset -nocomplain ::$k
+            }
+            dict for {k v} $delta {
+                trace remove variable ::$k {write unset} [list ::tdb_dirty $k]
+                set ::$k $v
+                trace add variable ::$k {write unset} [list ::tdb_dirty $k]
+            }
+        }} $delta $gone]
+    }
+    set ::tdb::_safeSeed($child) $snap
+    set ::tdb::_safeDirty($child) {}
+}
+
+proc ::tdb::_safeTouch {child name args} {
+    dict set ::tdb::_safeDirty($child) $name 1
+}
+
+proc ::tdb::_safeRelease {child size idle} {
+    if {![interp exists $child]} { ::tdb::_safeForget $child; return }
+    # Reset: drop globals and procs the script created, then make sure
+    # nothing else (renamed builtins, namespaces, aliases) changed
+    lassign $::tdb::_safeBase($child) baseGlobals baseProcs baseSig
+    if {[catch {
+        interp eval $child [list ::apply {{seed baseGlobals baseProcs} {
+            foreach g [info globals] {
+                if {![dict exists $seed $g] && [lsearch -exact $baseGlobals $g] < 0} {
+                    unset -nocomplain ::$g
+                }
+            }
+            foreach p [info procs] {
+                if {[lsearch -exact $baseProcs $p] < 0} { rename ::$p {} }
+            }
+        }} $::tdb::_safeSeed($child) $baseGlobals $baseProcs]
+        interp eval $child [list ::apply $::tdb::_safeSigLambda]
+    } sig] || $sig ne $baseSig} {
+        ::tdb::_safeDiscard $child
+        return
+    }
+    lappend ::tdb::_safePool [list $child [clock milliseconds]]
+    while {[llength $::tdb::_safePool] > $size} {
+        ::tdb::_safeDiscard [lindex $::tdb::_safePool 0 0]
+        set ::tdb::_safePool [lrange $::tdb::_safePool 1 end]
+    }
+    if {$idle > 0 && [llength $::tdb::_safePool] && $::tdb::_safeSweepId eq ""} {
+        set ::tdb::_safeSweepId [after $idle ::tdb::_safeSweepTimer]
+    }
+}
+
+proc ::tdb::_safeSweep {idle} {
+    # Evict children idle longer than -safeEval.idleMs
+    if {$idle <= 0 || ![llength $::tdb::_safePool]} { return }
+    set now [clock milliseconds]
+    set keep {}
+    foreach entry $::tdb::_safePool {
+        lassign $entry child used
+        if {$now - $used >= $idle} {
+            ::tdb::_safeDiscard $child
+        } else {
+            lappend keep $entry
+        }
+    }
+    set ::tdb::_safePool $keep
+}
+
+proc ::tdb::_safeSweepTimer {} {
+    set ::tdb::_safeSweepId ""
+    set idle [dict get [tdb::config] -safeEval.idleMs]
+    ::tdb::_safeSweep $idle
+    if {$idle > 0 && [llength $::tdb::_safePool]} {
+        set ::tdb::_safeSweepId [after $idle ::tdb::_safeSweepTimer]
+    }
+}
+
+proc ::tdb::_safeDiscard {child} {
+    catch { interp delete $child }
+    ::tdb::_safeForget $child
+}
+
+proc ::tdb::_safeForget {child} {
+    unset -nocomplain ::tdb::_safeSeed($child) ::tdb::_safeDirty($child) ::tdb::_safeBase($child)
+}
+
+proc ::tdb::_safeDrain {} {
+    # Called by tdb::stop: release every pooled child
+    if {$::tdb::_safeSweepId ne ""} {
+        after cancel $::tdb::_safeSweepId
+        set ::tdb::_safeSweepId ""
+    }
+    foreach entry $::tdb::_safePool {
+        ::tdb::_safeDiscard [lindex $entry 0]
+    }
+    set ::tdb::_safePool {}
+}
+
+# Pause/continue helpers (tdb::wait and tdb::on are native)
+
+proc ::tdb::_emit_log {fr id msg} {
+    if {$msg eq ""} { return }
+    puts $msg
+    set ev $fr
+    dict set ev event log
+    dict set ev reason logpoint
+    dict set ev id $id
+    dict set ev message $msg
+    ::tdb::_log_event $ev
 }
 
 proc ::tdb::continue {args} {
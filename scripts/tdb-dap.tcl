@@ -6,15 +6,7 @@ if {[catch {package require tdb} err]} {
     exit 1
 }
 
-# Extremely small JSON encoder/decoder for simple dicts
-proc toJson {d} {
-    set parts {}
-    foreach {k v} $d {
-        lappend parts \"$k\":\"[string map {" \" \\ \\\n+} $v]\"
-    }
-    return "{[join $parts ,]}"
-}
-
+# Replies are encoded natively by tdb::json; requests are flat objects
 proc fromJson {s} {
     # expects flat object {"k":"v",...}
     set s [string trim $s]
@@ -30,7 +22,9 @@ proc fromJson {s} {
 }
 
 proc send {chan d} {
-    puts $chan [toJson $d]
+    # Replies are built as key/value lists; make the top level an object
+    tdb::json -channel $chan [dict create {*}$d]
+    puts $chan ""
     flush $chan
 }
 
@@ -46,9 +40,13 @@ proc handle {chan} {
     } elseif {$cmd eq "setBreakpoints"} {
         # params: file, lines (comma-separated)
         set file [dict get $req file]
-        set lines [split [dict get $req lines] ,]
-        foreach l $lines { if {$l ne ""} { tdb::break add -file $file -line $l } }
-        set res {ok ok}
+        set lines {}
+        foreach l [split [dict get $req lines] ,] { if {$l ne ""} { lappend lines $l } }
+        set verified {}
+        foreach r [tdb::break set -file $file -lines $lines] {
+            lappend verified [dict get $r id]:[dict get $r verified]
+        }
+        set res [list ok ok breakpoints [join $verified ,]]
     } elseif {$cmd eq "continue"} {
         set ev [tdb::continue -wait]
         set res [list event [dict get $ev reason]]
@@ -62,18 +60,22 @@ proc handle {chan} {
         set ev [tdb::step out -wait]
         set res [list event [dict get $ev reason]]
     } elseif {$cmd eq "stackTrace"} {
-        set fr [tdb::frames]
-        set res [list frames [llength $fr]]
+        # startFrame/levels page through deep stacks; levels 0 means all
+        set start 0; set levels 0
+        if {[dict exists $req startFrame]} { set start [dict get $req startFrame] }
+        if {[dict exists $req levels]} { set levels [dict get $req levels] }
+        set page [tdb::frames -start $start -count $levels]
+        set res [list frames [dict get $page frames] totalFrames [dict get $page total]]
     } elseif {$cmd eq "scopes"} {
         set res {scopes locals,globals}
     } elseif {$cmd eq "variables"} {
         set scope [dict get $req scope]
         if {$scope eq "locals"} {
-            set vars [tdb::locals]
+            set vars [tdb::locals -full]
         } else {
             set vars [tdb::globals]
         }
-        set res [list vars [string length $vars]]
+        set res [list vars [dict create {*}$vars]]
     } elseif {$cmd eq "evaluate"} {
         set expr [dict get $req expr]
         set res [list result [tdb::eval -1 $expr]]